@@ -0,0 +1,155 @@
+/*
+ * Benchmarks for the drawing functions
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+// This program is linked once against the C drawing functions
+// (c_bench_drawing_funcs) and once against the assembly ones
+// (asm_bench_drawing_funcs), so running both side by side shows
+// where each implementation wins. Run "make bench" to do that.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "image.h"
+#include "drawing_funcs.h"
+#include "opacity.h"
+
+// 4K canvas
+#define CANVAS_W 3840
+#define CANVAS_H 2160
+
+typedef struct {
+  struct Image canvas;
+  struct Image tilemap;
+  struct Image spritemap;
+  struct Image indexed_spritemap;
+} BenchObjs;
+
+typedef struct {
+  const char *name;
+  void (*fn)(BenchObjs *objs, int i);
+  uint64_t pixels_per_call;
+  int calls;
+} BenchCase;
+
+double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void bench_pixels(BenchObjs *objs, int i) {
+  // one row of single pixel calls, the worst case for call overhead
+  int32_t y = i % CANVAS_H;
+  for (int32_t x = 0; x < CANVAS_W; x++) {
+    draw_pixel(&objs->canvas, x, y, 0x40c08080U);
+  }
+}
+
+void bench_rect_full(BenchObjs *objs, int i) {
+  struct Rect r = { .x = -(i % 3), .y = 0, .width = CANVAS_W + 3, .height = CANVAS_H };
+  draw_rect(&objs->canvas, &r, 0x2040a0c0U);
+}
+
+void bench_circle_large(BenchObjs *objs, int i) {
+  draw_circle(&objs->canvas, 1920 + i % 50, 1080, 1000, 0x7602d1c0U);
+}
+
+void bench_rect_opaque(BenchObjs *objs, int i) {
+  struct Rect r = { .x = (i * 37) % 1400, .y = (i * 11) % 560, .width = 512, .height = 512 };
+  draw_rect(&objs->canvas, &r, 0x1a0249ffU);
+}
+
+void bench_rect_blend(BenchObjs *objs, int i) {
+  struct Rect r = { .x = (i * 37) % 1400, .y = (i * 11) % 560, .width = 512, .height = 512 };
+  draw_rect(&objs->canvas, &r, 0x0000ff80U);
+}
+
+void bench_circle_blend(BenchObjs *objs, int i) {
+  draw_circle(&objs->canvas, 300 + (i * 37) % 1300, 300 + (i * 11) % 480, 256, 0x7602d180U);
+}
+
+void bench_tile_small(BenchObjs *objs, int i) {
+  struct Rect t = { .x = 64 + (i % 8) * 32, .y = 32, .width = 32, .height = 32 };
+  draw_tile(&objs->canvas, (i * 32) % CANVAS_W, ((i / 60) * 32) % CANVAS_H, &objs->tilemap, &t);
+}
+
+void bench_tile_large(BenchObjs *objs, int i) {
+  struct Rect t = { .x = 0, .y = 0, .width = 512, .height = 320 };
+  draw_tile(&objs->canvas, (i * 37) % 1400, (i * 11) % 760, &objs->tilemap, &t);
+}
+
+void bench_sprite_small(BenchObjs *objs, int i) {
+  struct Rect s = { .x = 256, .y = 272, .width = 32, .height = 30 };
+  draw_sprite(&objs->canvas, (i * 32) % CANVAS_W, ((i / 60) * 32) % CANVAS_H, &objs->spritemap, &s);
+}
+
+void bench_sprite_sheet(BenchObjs *objs, int i) {
+  struct Rect s = { .x = 0, .y = 0, .width = 640, .height = 368 };
+  draw_sprite(&objs->canvas, (i * 37) % 1280, (i * 11) % 712, &objs->spritemap, &s);
+}
+
+void bench_sprite_sheet_indexed(BenchObjs *objs, int i) {
+  struct Rect s = { .x = 0, .y = 0, .width = 640, .height = 368 };
+  draw_sprite(&objs->canvas, (i * 37) % 1280, (i * 11) % 712, &objs->indexed_spritemap, &s);
+}
+
+BenchCase cases[] = {
+  { "pixel x3840",              bench_pixels,               CANVAS_W,  2000 },
+  { "rect 3840x2160 blended",   bench_rect_full,            (uint64_t) CANVAS_W * CANVAS_H, 20 },
+  { "circle r=1000 blended",    bench_circle_large,         3141592,   40 },
+  { "rect 512x512 opaque",      bench_rect_opaque,          512 * 512, 400 },
+  { "rect 512x512 blended",     bench_rect_blend,           512 * 512, 400 },
+  { "circle r=256 blended",     bench_circle_blend,         205887,    400 },
+  { "tile 32x32",               bench_tile_small,           32 * 32,   40000 },
+  { "tile 512x320",             bench_tile_large,           512 * 320, 400 },
+  { "sprite 32x30",             bench_sprite_small,         32 * 30,   40000 },
+  { "sprite 640x368",           bench_sprite_sheet,         640 * 368, 200 },
+  { "sprite 640x368 (indexed)", bench_sprite_sheet_indexed, 640 * 368, 200 },
+};
+
+int main(int argc, char **argv) {
+  // optional argument scales the number of calls of every case
+  double scale = argc > 1 ? atof(argv[1]) : 1.0;
+
+  BenchObjs objs;
+  if (init_image(&objs.canvas, CANVAS_W, CANVAS_H) != IMG_SUCCESS ||
+      read_image("img/PrtMimi_lg.png", &objs.tilemap) != IMG_SUCCESS ||
+      read_image("img/NpcGuest_lg.png", &objs.spritemap) != IMG_SUCCESS ||
+      read_image("img/NpcGuest_lg.png", &objs.indexed_spritemap) != IMG_SUCCESS ||
+      attach_opacity_index(&objs.indexed_spritemap) != IMG_SUCCESS) {
+    fprintf(stderr, "Error: could not set up benchmark images\n");
+    return 1;
+  }
+
+  printf("%-26s %10s %12s %10s\n", "case", "calls", "ms", "ns/pixel");
+  for (unsigned c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    int calls = (int) (cases[c].calls * scale);
+    if (calls < 1) {
+      calls = 1;
+    }
+
+    double start = now_ms();
+    for (int i = 0; i < calls; i++) {
+      cases[c].fn(&objs, i);
+    }
+    double elapsed = now_ms() - start;
+
+    double ns_per_pixel = elapsed * 1000000.0 / ((double) cases[c].pixels_per_call * calls);
+    printf("%-26s %10d %12.2f %10.3f\n", cases[c].name, calls, elapsed, ns_per_pixel);
+  }
+
+  free(objs.canvas.data);
+  free(objs.tilemap.data);
+  free(objs.spritemap.data);
+  detach_opacity_index(&objs.indexed_spritemap);
+  free(objs.indexed_spritemap.data);
+
+  return 0;
+}
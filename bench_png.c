@@ -0,0 +1,208 @@
+/*
+ * Benchmark of PNG encoding
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+// Encodes every PNG named on the command line with several
+// compression levels, strategies, filter modes, and numbers of
+// threads (and each filter kernel implementation), and prints the
+// total bytes written and encode time, then the time to decode
+// the files with each unfilter implementation, and the speed of
+// each CRC32 implementation (and zlib's) on a multi-megabyte
+// buffer like a large IDAT. Run "make bench" to use it on the
+// expected/*.png corpus.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
+#include "image.h"
+#include "pnglite.h"
+#include "pnglite_simd.h"
+#include "pnglite_crc.h"
+#include "parallel.h"
+
+typedef struct {
+  const char *name;
+  int level;
+  int strategy;
+  int mode;
+  const char *impl;
+  unsigned threads;  // 0 for one per core (the "xN" cases)
+} PngBenchCase;
+
+PngBenchCase cases[] = {
+  { "none",              -1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_NONE,      "scalar", 1 },
+  { "fast",              -1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_FAST,      "sse2",   1 },
+  { "balanced",          -1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_BALANCED,  "sse2",   1 },
+  { "balanced scalar",   -1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_BALANCED,  "scalar", 1 },
+  { "max",               -1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_MAX,       "sse2",   1 },
+  { "level 1",            1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_NONE,      "sse2",   1 },
+  { "level 1 fast",       1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_FAST,      "sse2",   1 },
+  { "level 1 rle",        1, IMG_STRATEGY_RLE,      PNG_FILTER_MODE_NONE,      "sse2",   1 },
+  { "level 1 rle fast",   1, IMG_STRATEGY_RLE,      PNG_FILTER_MODE_FAST,      "sse2",   1 },
+  { "huffman fast",       1, IMG_STRATEGY_HUFFMAN,  PNG_FILTER_MODE_FAST,      "sse2",   1 },
+  { "level 9",            9, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_NONE,      "sse2",   1 },
+  { "level 9 filtered",   9, IMG_STRATEGY_FILTERED, PNG_FILTER_MODE_BALANCED,  "sse2",   1 },
+  { "level 9 max",        9, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_MAX,       "sse2",   1 },
+  { "none x2",           -1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_NONE,      "sse2",   2 },
+  { "none xN",           -1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_NONE,      "sse2",   0 },
+  { "level 1 xN",         1, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_NONE,      "sse2",   0 },
+  { "level 9 xN",         9, IMG_STRATEGY_DEFAULT,  PNG_FILTER_MODE_NONE,      "sse2",   0 },
+};
+
+double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// write callback that only counts the bytes
+unsigned count_bytes(void *input, size_t size, size_t numel, void *user_pointer) {
+  (void) input;
+  *(size_t *) user_pointer += size * numel;
+  return (unsigned) numel;
+}
+
+// Encode an image in memory.
+// Returns the number of bytes the PNG file would have.
+size_t encode(const struct Image *img, const PngBenchCase *settings, unsigned char *rgba) {
+  size_t bytes = 0;
+  png_t png;
+  png_open_write(&png, count_bytes, &bytes);
+  png_set_compression(&png, settings->level, settings->strategy);
+  png_set_filter_mode(&png, settings->mode);
+  png_set_threads(&png, settings->threads != 0 ? settings->threads : parallel_default_threads());
+
+  // PNG wants big-endian RGBA
+  for (uint32_t i = 0; i < img->width * img->height; i++) {
+    uint32_t p = img->data[i];
+    rgba[i * 4 + 0] = p >> 24;
+    rgba[i * 4 + 1] = p >> 16;
+    rgba[i * 4 + 2] = p >> 8;
+    rgba[i * 4 + 3] = p;
+  }
+
+  if (png_set_data(&png, img->width, img->height, 8, PNG_TRUECOLOR_ALPHA, rgba) != PNG_NO_ERROR) {
+    return 0;
+  }
+  return bytes;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s [-n reps] image.png...\n", argv[0]);
+    return 1;
+  }
+
+  int first = 1, reps = 5;
+  if (argc > 3 && argv[1][0] == '-' && argv[1][1] == 'n') {
+    reps = atoi(argv[2]);
+    first = 3;
+  }
+
+  int num_images = argc - first;
+  struct Image *images = (struct Image *) calloc(num_images, sizeof(struct Image));
+  uint64_t pixels = 0;
+  for (int i = 0; i < num_images; i++) {
+    if (read_image(argv[first + i], &images[i]) != IMG_SUCCESS) {
+      fprintf(stderr, "Error: could not read %s\n", argv[first + i]);
+      return 1;
+    }
+    pixels += (uint64_t) images[i].width * images[i].height;
+  }
+
+  printf("%d images, %llu pixels, %d reps\n", num_images, (unsigned long long) pixels, reps);
+  printf("%-18s %12s %12s %10s\n", "settings", "bytes", "ms", "ns/pixel");
+  for (unsigned c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    if (!png_simd_select(cases[c].impl)) {
+      continue;
+    }
+
+    size_t bytes = 0;
+    double start = now_ms();
+    for (int r = 0; r < reps; r++) {
+      bytes = 0;
+      for (int i = 0; i < num_images; i++) {
+        unsigned char *rgba = (unsigned char *) malloc((size_t) images[i].width * images[i].height * 4 + 1);
+        bytes += encode(&images[i], &cases[c], rgba);
+        free(rgba);
+      }
+    }
+    double elapsed = (now_ms() - start) / reps;
+
+    printf("%-18s %12zu %12.2f %10.2f\n", cases[c].name, bytes, elapsed, elapsed * 1000000.0 / pixels);
+  }
+
+  // each kernel on one thread, then on one thread per core
+  const char *impls[] = { "avx2", "ssse3", "sse2", "scalar" };
+  printf("\n%-18s %12s %10s\n", "decode", "ms", "ns/pixel");
+  for (unsigned m = 0; m < sizeof(impls) / sizeof(impls[0]); m++) {
+    if (!png_simd_select(impls[m])) {
+      continue;
+    }
+
+    uint32_t threads[] = { 1, 0 };
+    for (unsigned t = 0; t < 2; t++) {
+      struct ImageReadOptions opts = { .threads = threads[t] };
+      double start = now_ms();
+      for (int r = 0; r < reps; r++) {
+        for (int i = 0; i < num_images; i++) {
+          struct Image decoded;
+          if (read_image_ex(argv[first + i], &decoded, &opts) != IMG_SUCCESS) {
+            fprintf(stderr, "Error: could not read %s\n", argv[first + i]);
+            return 1;
+          }
+          free(decoded.data);
+        }
+      }
+      double elapsed = (now_ms() - start) / reps;
+
+      char name[32];
+      snprintf(name, sizeof(name), "%s %s", impls[m], threads[t] ? "x1" : "xN");
+      printf("%-18s %12.2f %10.2f\n", name, elapsed, elapsed * 1000000.0 / pixels);
+    }
+  }
+
+  // random bytes, since compressed data looks random
+  const size_t crc_len = 8 << 20;
+  unsigned char *payload = (unsigned char *) malloc(crc_len);
+  if (payload == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    return 1;
+  }
+  uint32_t seed = 1;
+  for (size_t i = 0; i < crc_len; i++) {
+    seed = seed * 1103515245U + 12345U;
+    payload[i] = (unsigned char) (seed >> 16);
+  }
+
+  const char *crc_impls[] = { "zlib", "pclmul", "slice8" };
+  printf("\n%-18s %12s %10s\n", "crc32 8 MiB", "ms", "GB/s");
+  for (unsigned m = 0; m < sizeof(crc_impls) / sizeof(crc_impls[0]); m++) {
+    int use_zlib = m == 0;
+    if (!use_zlib && !png_crc_select(crc_impls[m])) {
+      continue;
+    }
+
+    uint32_t crc = 0;
+    double start = now_ms();
+    for (int r = 0; r < reps * 4; r++) {
+      crc = use_zlib ? (uint32_t) crc32(crc, payload, crc_len) : png_crc32(crc, payload, crc_len);
+    }
+    double elapsed = (now_ms() - start) / (reps * 4);
+
+    printf("%-18s %12.3f %10.2f\n", crc_impls[m], elapsed, crc_len / (elapsed * 1000000.0));
+  }
+  free(payload);
+
+  for (int i = 0; i < num_images; i++) {
+    free(images[i].data);
+  }
+  free(images);
+  return 0;
+}
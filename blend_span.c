@@ -0,0 +1,290 @@
+/*
+ * Span blending kernels
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+// Blends whole runs of pixels at once. The math is the same as
+// blend_colors/blend_components, except that the divide by 255 is
+// replaced by (x + 1 + (x >> 8)) >> 8, which is exact for every
+// value alpha*fg + (255-alpha)*bg can take (0..255*255), so the
+// SIMD versions can work in 16 bit lanes.
+
+#include <string.h>
+#include "blend_span.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLEND_SPAN_X86 1
+#else
+#define BLEND_SPAN_X86 0
+#endif
+
+struct BlendSpanImpl {
+  const char *name;
+  void (*fill)(uint32_t *dst, uint32_t color, int32_t n);
+  void (*blend)(uint32_t *dst, const uint32_t *src, int32_t n);
+};
+
+////////////////////////////////////////////////////////////////////////
+// Scalar implementation
+////////////////////////////////////////////////////////////////////////
+
+//
+// Divides by 255, exact for 0 <= x <= 255*255.
+//
+static inline uint32_t div255(uint32_t x) {
+  return (x + 1 + (x >> 8)) >> 8;
+}
+
+//
+// Blends fg over bg, identical to blend_colors(fg, bg).
+//
+static inline uint32_t blend_pixel(uint32_t fg, uint32_t bg) {
+  uint32_t alpha = fg & 0xFF;
+  uint32_t inv_alpha = 255 - alpha;
+
+  uint32_t r = div255(((fg >> 24) & 0xFF) * alpha + ((bg >> 24) & 0xFF) * inv_alpha);
+  uint32_t g = div255(((fg >> 16) & 0xFF) * alpha + ((bg >> 16) & 0xFF) * inv_alpha);
+  uint32_t b = div255(((fg >> 8) & 0xFF) * alpha + ((bg >> 8) & 0xFF) * inv_alpha);
+
+  return (r << 24) | (g << 16) | (b << 8) | 0xFF;
+}
+
+static void fill_scalar(uint32_t *dst, uint32_t color, int32_t n) {
+  for (int32_t i = 0; i < n; i++) {
+    dst[i] = blend_pixel(color, dst[i]);
+  }
+}
+
+static void blend_scalar(uint32_t *dst, const uint32_t *src, int32_t n) {
+  for (int32_t i = 0; i < n; i++) {
+    dst[i] = blend_pixel(src[i], dst[i]);
+  }
+}
+
+#if BLEND_SPAN_X86
+
+////////////////////////////////////////////////////////////////////////
+// SSE2 implementation (4 pixels per iteration)
+////////////////////////////////////////////////////////////////////////
+
+// Pixels are stored little endian, so in memory each pixel is the
+// bytes A,B,G,R. After unpacking to 16 bits that is lanes 0-3 of a
+// pixel, with the alpha in lane 0.
+
+__attribute__((target("sse2")))
+static inline __m128i div255_sse2(__m128i x) {
+  __m128i one = _mm_set1_epi16(1);
+  return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void fill_sse2(uint32_t *dst, uint32_t color, int32_t n) {
+  uint32_t alpha = color & 0xFF;
+  __m128i zero = _mm_setzero_si128();
+  __m128i opaque = _mm_set1_epi32(0xFF);
+  __m128i inv_alpha = _mm_set1_epi16((short) (255 - alpha));
+
+  // alpha * fg for each channel of two pixels, computed once
+  __m128i fg = _mm_unpacklo_epi8(_mm_set1_epi32((int) color), zero);
+  __m128i fg_scaled = _mm_mullo_epi16(fg, _mm_set1_epi16((short) alpha));
+
+  int32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i bg = _mm_loadu_si128((const __m128i *) (dst + i));
+    __m128i lo = _mm_unpacklo_epi8(bg, zero);
+    __m128i hi = _mm_unpackhi_epi8(bg, zero);
+
+    lo = div255_sse2(_mm_add_epi16(_mm_mullo_epi16(lo, inv_alpha), fg_scaled));
+    hi = div255_sse2(_mm_add_epi16(_mm_mullo_epi16(hi, inv_alpha), fg_scaled));
+
+    __m128i out = _mm_or_si128(_mm_packus_epi16(lo, hi), opaque);
+    _mm_storeu_si128((__m128i *) (dst + i), out);
+  }
+
+  fill_scalar(dst + i, color, n - i);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i blend_half_sse2(__m128i fg, __m128i bg) {
+  // broadcast each pixel's alpha to all four of its lanes
+  __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(fg, 0x00), 0x00);
+  __m128i inv_alpha = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+  __m128i sum = _mm_add_epi16(_mm_mullo_epi16(fg, alpha), _mm_mullo_epi16(bg, inv_alpha));
+  return div255_sse2(sum);
+}
+
+__attribute__((target("sse2")))
+static void blend_sse2(uint32_t *dst, const uint32_t *src, int32_t n) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i opaque = _mm_set1_epi32(0xFF);
+
+  int32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i fg = _mm_loadu_si128((const __m128i *) (src + i));
+    __m128i bg = _mm_loadu_si128((const __m128i *) (dst + i));
+
+    __m128i lo = blend_half_sse2(_mm_unpacklo_epi8(fg, zero), _mm_unpacklo_epi8(bg, zero));
+    __m128i hi = blend_half_sse2(_mm_unpackhi_epi8(fg, zero), _mm_unpackhi_epi8(bg, zero));
+
+    __m128i out = _mm_or_si128(_mm_packus_epi16(lo, hi), opaque);
+    _mm_storeu_si128((__m128i *) (dst + i), out);
+  }
+
+  blend_scalar(dst + i, src + i, n - i);
+}
+
+////////////////////////////////////////////////////////////////////////
+// AVX2 implementation (8 pixels per iteration)
+////////////////////////////////////////////////////////////////////////
+
+// The unpack and pack instructions work within each 128 bit half,
+// so the pixel order comes back out the same way it went in.
+
+__attribute__((target("avx2")))
+static inline __m256i div255_avx2(__m256i x) {
+  __m256i one = _mm256_set1_epi16(1);
+  return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, one), _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(uint32_t *dst, uint32_t color, int32_t n) {
+  uint32_t alpha = color & 0xFF;
+  __m256i zero = _mm256_setzero_si256();
+  __m256i opaque = _mm256_set1_epi32(0xFF);
+  __m256i inv_alpha = _mm256_set1_epi16((short) (255 - alpha));
+
+  __m256i fg = _mm256_unpacklo_epi8(_mm256_set1_epi32((int) color), zero);
+  __m256i fg_scaled = _mm256_mullo_epi16(fg, _mm256_set1_epi16((short) alpha));
+
+  int32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i bg = _mm256_loadu_si256((const __m256i *) (dst + i));
+    __m256i lo = _mm256_unpacklo_epi8(bg, zero);
+    __m256i hi = _mm256_unpackhi_epi8(bg, zero);
+
+    lo = div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(lo, inv_alpha), fg_scaled));
+    hi = div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(hi, inv_alpha), fg_scaled));
+
+    __m256i out = _mm256_or_si256(_mm256_packus_epi16(lo, hi), opaque);
+    _mm256_storeu_si256((__m256i *) (dst + i), out);
+  }
+
+  fill_sse2(dst + i, color, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_half_avx2(__m256i fg, __m256i bg) {
+  __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(fg, 0x00), 0x00);
+  __m256i inv_alpha = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+  __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(fg, alpha), _mm256_mullo_epi16(bg, inv_alpha));
+  return div255_avx2(sum);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(uint32_t *dst, const uint32_t *src, int32_t n) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i opaque = _mm256_set1_epi32(0xFF);
+
+  int32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i fg = _mm256_loadu_si256((const __m256i *) (src + i));
+    __m256i bg = _mm256_loadu_si256((const __m256i *) (dst + i));
+
+    __m256i lo = blend_half_avx2(_mm256_unpacklo_epi8(fg, zero), _mm256_unpacklo_epi8(bg, zero));
+    __m256i hi = blend_half_avx2(_mm256_unpackhi_epi8(fg, zero), _mm256_unpackhi_epi8(bg, zero));
+
+    __m256i out = _mm256_or_si256(_mm256_packus_epi16(lo, hi), opaque);
+    _mm256_storeu_si256((__m256i *) (dst + i), out);
+  }
+
+  blend_sse2(dst + i, src + i, n - i);
+}
+
+#endif // BLEND_SPAN_X86
+
+////////////////////////////////////////////////////////////////////////
+// Runtime dispatch
+////////////////////////////////////////////////////////////////////////
+
+static const struct BlendSpanImpl impls[] = {
+#if BLEND_SPAN_X86
+  { "avx2", fill_avx2, blend_avx2 },
+  { "sse2", fill_sse2, blend_sse2 },
+#endif
+  { "scalar", fill_scalar, blend_scalar },
+};
+
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static const struct BlendSpanImpl *current_impl = &impls[NUM_IMPLS - 1];
+
+//
+// Checks whether the CPU can run the named implementation.
+//
+static int impl_supported(const char *name) {
+#if BLEND_SPAN_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2");
+  }
+  if (strcmp(name, "sse2") == 0) {
+    return __builtin_cpu_supports("sse2");
+  }
+#endif
+  return strcmp(name, "scalar") == 0;
+}
+
+//
+// Picks the fastest supported implementation at program startup.
+//
+__attribute__((constructor))
+static void blend_span_init(void) {
+  for (unsigned i = 0; i < NUM_IMPLS; i++) {
+    if (impl_supported(impls[i].name)) {
+      current_impl = &impls[i];
+      return;
+    }
+  }
+}
+
+int blend_span_select(const char *name) {
+  for (unsigned i = 0; i < NUM_IMPLS; i++) {
+    if (strcmp(impls[i].name, name) == 0 && impl_supported(name)) {
+      current_impl = &impls[i];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+const char *blend_span_impl(void) {
+  return current_impl->name;
+}
+
+void blend_span(uint32_t *dst, uint32_t color, int32_t n) {
+  uint32_t alpha = color & 0xFF;
+
+  if (alpha == 0xFF) {
+    // fully opaque: blend_colors(color, bg) is just color
+    for (int32_t i = 0; i < n; i++) {
+      dst[i] = color;
+    }
+  } else if (alpha == 0x00) {
+    // fully transparent: the background color survives, but
+    // blend_colors always produces an opaque result
+    for (int32_t i = 0; i < n; i++) {
+      dst[i] |= 0xFF;
+    }
+  } else {
+    current_impl->fill(dst, color, n);
+  }
+}
+
+void blend_span_src(uint32_t *dst, const uint32_t *src, int32_t n) {
+  current_impl->blend(dst, src, n);
+}
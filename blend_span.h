@@ -0,0 +1,50 @@
+/*
+ * Span blending kernels
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef BLEND_SPAN_H
+#define BLEND_SPAN_H
+
+#include <stdint.h>
+
+// Blend a single color over a run of n pixels.
+// Every resulting pixel is bit for bit identical to
+// blend_colors(color, dst[i]).
+//
+// Parameters:
+//   dst   - pointer to the first pixel of the run
+//   color - uint32_t color value (foreground)
+//   n     - number of pixels in the run
+void blend_span(uint32_t *dst, uint32_t color, int32_t n);
+
+// Blend a run of source pixels over a run of n destination pixels.
+// Every resulting pixel is bit for bit identical to
+// blend_colors(src[i], dst[i]).
+//
+// Parameters:
+//   dst - pointer to the first destination pixel
+//   src - pointer to the first source (foreground) pixel
+//   n   - number of pixels in the run
+void blend_span_src(uint32_t *dst, const uint32_t *src, int32_t n);
+
+// Select the implementation used by blend_span and blend_span_src.
+// By default the fastest one supported by the CPU is chosen
+// ("avx2", then "sse2", then "scalar").
+//
+// Parameters:
+//   name - one of "avx2", "sse2", or "scalar"
+//
+// Returns:
+//   1 if the implementation was selected, 0 if it is unknown or
+//   not supported on this CPU
+int blend_span_select(const char *name);
+
+// Returns:
+//   the name of the implementation currently in use
+const char *blend_span_impl(void);
+
+#endif // BLEND_SPAN_H
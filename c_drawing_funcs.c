@@ -12,7 +12,11 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "drawing_funcs.h"
+#include "blend_span.h"
+#include "clip.h"
+#include "opacity.h"
 
 ////////////////////////////////////////////////////////////////////////
 // Helper functions
@@ -204,6 +208,74 @@ int64_t square_dist(int64_t x1, int64_t y1, int64_t x2, int64_t y2) {
 }
 
 
+//
+// Finds how far a row of a circle extends to either side of the center.
+// Uses the same square_dist <= r*r test as a per pixel check would,
+// so the row contains exactly the pixels that test accepts.
+//
+// Parameters:
+//   dy        - offset of the row from the center of the circle
+//   r         - radius of circle (dy must be within [-r, r])
+//   r_squared - r * r
+//
+// Returns:
+//   The largest dx such that (dx, dy) is inside the circle.
+//
+static int64_t circle_half_width(int64_t dy, int64_t r, int64_t r_squared) {
+  int64_t lo = 0; // always inside, since |dy| <= r
+  int64_t hi = r; // |dx| can never exceed the radius
+
+  // binary search for the last dx that is inside the circle
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo + 1) / 2;
+    if (square_dist(0, 0, mid, dy) <= r_squared) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+//
+// Blends one row of a sprite using the sprite sheet's opacity runs:
+// transparent runs only get their alpha forced to opaque (which is
+// what blend_colors does), opaque runs are copied, and only the
+// partially transparent runs are actually blended.
+//
+// Parameters:
+//   dst     - pointer to the first destination pixel
+//   src     - pointer to the first source pixel (column src_x of row src_y)
+//   index   - opacity index of the sprite sheet
+//   src_y   - row of the sprite sheet
+//   src_x   - first column of the sprite sheet
+//   n       - number of pixels in the row
+//
+static void blend_sprite_runs(uint32_t *dst, const uint32_t *src,
+                              const struct OpacityIndex *index,
+                              uint32_t src_y, uint32_t src_x, int32_t n) {
+  uint32_t run = find_opacity_run(index, src_y, src_x);
+  int32_t col = 0;
+
+  while (col < n) {
+    const struct OpacityRun *r = &index->runs[run++];
+    int32_t run_end = (int32_t) (r->x + r->length - src_x);
+    if (run_end > n) {
+      run_end = n;
+    }
+
+    if (r->kind == OPACITY_OPAQUE) {
+      memcpy(dst + col, src + col, (run_end - col) * sizeof(uint32_t));
+    } else if (r->kind == OPACITY_TRANSPARENT) {
+      for (int32_t i = col; i < run_end; i++) {
+        dst[i] |= 0xFF;
+      }
+    } else {
+      blend_span_src(dst + col, src + col, run_end - col);
+    }
+    col = run_end;
+  }
+}
 
 ////////////////////////////////////////////////////////////////////////
 // API functions
@@ -237,13 +309,17 @@ void draw_pixel(struct Image *img, int32_t x, int32_t y, uint32_t color) {
 void draw_rect(struct Image *img,
                const struct Rect *rect,
                uint32_t color) {
+  struct Rect clipped;
 
-  for (int y = rect->y; y < rect->y + rect->height; y++) {
-    for (int x = rect->x; x < rect->x + rect->width; x++) {
-      if (in_bounds(img, x, y)) {
-        set_pixel(img, compute_index(img, x, y), color);
-      }
-    }
+  // clip once, then every row is a contiguous span of pixels
+  if (!clip_rect(img, rect, &clipped)) {
+    return;
+  }
+
+  uint32_t *row = img->data + compute_index(img, clipped.x, clipped.y);
+  for (int32_t y = 0; y < clipped.height; y++) {
+    blend_span(row, color, clipped.width);
+    row += img->width;
   }
 }
 
@@ -259,13 +335,20 @@ void draw_rect(struct Image *img,
 //   color   - uint32_t color value
 //
 void draw_circle(struct Image *img, int32_t x, int32_t y, int32_t r, uint32_t color) {
-  // Iterate over the square that bounds the circle
-  for (int i = y - r; i <= y + r; i++) {
-    for (int j = x - r; j <= x + r; j++) {
-      if (square_dist(x, y, j, i) <= r * r) {
-        // Point is inside the circle, draw the pixel
-        draw_pixel(img, j, i, color);
-      }
+  int64_t r_squared = (int64_t) r * r;
+
+  // only rows of the bounding square that are on the image matter
+  int64_t y_start = (int64_t) y - r < 0 ? 0 : (int64_t) y - r;
+  int64_t y_end = (int64_t) y + r >= img->height ? (int64_t) img->height - 1 : (int64_t) y + r;
+
+  for (int64_t i = y_start; i <= y_end; i++) {
+    // every row of a circle is one run centered on x
+    int64_t half_width = circle_half_width(i - y, r, r_squared);
+    int64_t x_start = (int64_t) x - half_width < 0 ? 0 : (int64_t) x - half_width;
+    int64_t x_end = (int64_t) x + half_width >= img->width ? (int64_t) img->width - 1 : (int64_t) x + half_width;
+
+    if (x_start <= x_end) {
+      blend_span(img->data + compute_index(img, x_start, i), color, x_end - x_start + 1);
     }
   }
 }
@@ -290,20 +373,26 @@ void draw_tile(struct Image *img,
                const struct Rect *tile) {
 
   // stop execution if out of bounds access to tilemap
-  for (int y = 0; y < tile->height; y++) {
-    for (int x = 0; x < tile->width; x++) {
-      if (!in_bounds(tilemap, x + tile->x, y + tile->y)) {
-        return;
-      }
-    }
+  if (!rect_in_bounds(tilemap, tile)) {
+    return;
   }
-  // copy pixels from tile map to destination img 
-  for (int y = 0; y < tile->height; y++) {
-    for (int x = 0; x < tile->width; x++) {
-      if (in_bounds(img, X + x, Y + y)) {
-        img->data[compute_index(img, X + x, Y + y)] = tilemap->data[compute_index(tilemap, x + tile->x, y + tile->y)];
-      }
-    }
+
+  // clip the destination once, then copy whole rows
+  struct Rect dest = { .x = X, .y = Y, .width = tile->width, .height = tile->height };
+  struct Rect clipped;
+  if (!clip_rect(img, &dest, &clipped)) {
+    return;
+  }
+
+  uint32_t *dst_row = img->data + compute_index(img, clipped.x, clipped.y);
+  const uint32_t *src_row = tilemap->data + compute_index(tilemap,
+      tile->x + (clipped.x - X), tile->y + (clipped.y - Y));
+  size_t row_bytes = clipped.width * sizeof(uint32_t);
+  for (int32_t row = 0; row < clipped.height; row++) {
+    // memmove, since the tilemap is allowed to be the destination image
+    memmove(dst_row, src_row, row_bytes);
+    dst_row += img->width;
+    src_row += tilemap->width;
   }
 }
 
@@ -328,20 +417,28 @@ void draw_sprite(struct Image *img,
                  const struct Rect *sprite) {
 
   // stop execution if out of bounds access to spritemap
-  for (int y_sprite = 0; y_sprite < sprite->height; y_sprite++) {
-    for (int x_sprite = 0; x_sprite < sprite->width; x_sprite++) {
-      if (!in_bounds(spritemap, x_sprite + sprite->x, y_sprite + sprite->y)) {
-        return;
-      }
-    }
+  if (!rect_in_bounds(spritemap, sprite)) {
+    return;
   }
-  // copy pixels from sprite map to destination img 
-  for (int y_sprite = 0; y_sprite < sprite->height; y_sprite++) {
-    for (int x_sprite = 0; x_sprite < sprite->width; x_sprite++) {
-      if (in_bounds(img, x + x_sprite, y + y_sprite)) {
-        uint32_t sprite_color = spritemap->data[compute_index(spritemap, x_sprite + sprite->x, y_sprite + sprite->y)];
-        set_pixel(img, compute_index(img, x + x_sprite, y + y_sprite), sprite_color);
-      }
+
+  // clip the destination once, then blend whole rows
+  struct Rect dest = { .x = x, .y = y, .width = sprite->width, .height = sprite->height };
+  struct Rect clipped;
+  if (!clip_rect(img, &dest, &clipped)) {
+    return;
+  }
+
+  uint32_t *dst_row = img->data + compute_index(img, clipped.x, clipped.y);
+  const uint32_t *src_row = spritemap->data + compute_index(spritemap,
+      sprite->x + (clipped.x - x), sprite->y + (clipped.y - y));
+  for (int32_t row = 0; row < clipped.height; row++) {
+    if (spritemap->opacity != NULL) {
+      blend_sprite_runs(dst_row, src_row, spritemap->opacity,
+                        sprite->y + (clipped.y - y) + row, sprite->x + (clipped.x - x), clipped.width);
+    } else {
+      blend_span_src(dst_row, src_row, clipped.width);
     }
+    dst_row += img->width;
+    src_row += spritemap->width;
   }
-}
\ No newline at end of file
+}
@@ -7,11 +7,26 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "image.h"
+#include "image_cache.h"
 #include "drawing_funcs.h"
+#include "parallel.h"
+#include "display_list.h"
+#include "cull.h"
+#include "render.h"
 
 #define NUM_IMAGE_SLOTS 8
 
+// default size limit of the decoded image cache (-c), in MiB
+#define DEFAULT_CACHE_MIB 256
+
+// longest line of a batch manifest (-b)
+#define MAX_MANIFEST_LINE 1024
+
 void skipws(FILE *in) {
   for (;;) {
     int c = fgetc(in);
@@ -25,19 +40,143 @@ void skipws(FILE *in) {
   }
 }
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    fprintf(stderr, "Error: invalid command line arguments\n");
-    return 1;
+// Parse the PNG options of -z: a comma separated list of a
+// preset (default, preview, or archive) and/or settings
+// level=N, strategy=S, filter=F, idat=BYTES, and threads=N,
+// applied in order.
+// Returns 1 if every item was understood, 0 otherwise.
+int parse_png_options(char *arg, struct PngWriteOptions *opts) {
+  char *const tokens[] = { "default", "preview", "archive", "level", "strategy", "filter", "idat", "threads", NULL };
+  const char *strategies[] = { "default", "filtered", "huffman", "rle", "fixed" };
+  const char *filters[] = { "none", "fast", "balanced", "max" };
+
+  while (*arg != '\0') {
+    char *value;
+    int token = getsubopt(&arg, tokens, &value);
+    if (token >= 0 && token <= 2) {
+      const struct PngWriteOptions *presets[] = { &PNG_WRITE_DEFAULT, &PNG_WRITE_PREVIEW, &PNG_WRITE_ARCHIVE };
+      *opts = *presets[token];
+      continue;
+    }
+    if (token < 0 || value == NULL) {
+      return 0;
+    }
+
+    int found = 0;
+    if (token == 3) {
+      opts->level = atoi(value);
+      found = opts->level >= -1 && opts->level <= 9;
+    } else if (token == 4) {
+      for (int i = 0; i < 5; i++) {
+        if (strcmp(value, strategies[i]) == 0) {
+          opts->strategy = i;
+          found = 1;
+        }
+      }
+    } else if (token == 5) {
+      for (int i = 0; i < 4; i++) {
+        if (strcmp(value, filters[i]) == 0) {
+          opts->filter_mode = i;
+          found = 1;
+        }
+      }
+    } else if (token == 6) {
+      opts->idat_size = (uint32_t) strtoul(value, NULL, 10);
+      found = opts->idat_size >= 1 && opts->idat_size <= 0x7fffffffU;
+    } else {
+      opts->threads = (uint32_t) atoi(value);
+      found = atoi(value) > 0;
+    }
+    if (!found) {
+      return 0;
+    }
   }
+  return 1;
+}
 
-  struct Image canvas = {
-    .data = NULL,
-    .width = 0,
-    .height = 0,
-  };
+double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Canvases of finished scenes, kept so that a later scene of the
+// same size can draw on one without allocating (and faulting in)
+// a new buffer. Shared by the threads of a batch.
+struct CanvasPool {
+  pthread_mutex_t lock;
+  struct Image *canvases;
+  uint32_t count;
+  uint32_t capacity;  // canvases kept at most
+};
+
+// Settings shared by every scene of a run.
+struct RenderSettings {
+  uint32_t num_threads;      // threads to render each scene with
+  int use_tiles;
+  int print_stats;
+  struct PngWriteOptions png_options;
+  struct ImageCache *cache;  // where L loads images from
+  struct CanvasPool *pool;   // NULL to always allocate canvases
+};
+
+// One scene file and the PNG it is rendered to.
+struct Scene {
+  const char *input;   // NULL for stdin
+  const char *output;
+  double parse_ms, render_ms, encode_ms;
+  int error;
+};
+
+// Get a canvas of the given size, initialized like init_image:
+// one from the pool if a finished scene left one, otherwise a
+// new one.
+int take_canvas(struct CanvasPool *pool, struct Image *canvas, uint32_t width, uint32_t height) {
+  if (pool != NULL) {
+    pthread_mutex_lock(&pool->lock);
+    for (uint32_t i = 0; i < pool->count; i++) {
+      if (pool->canvases[i].width == width && pool->canvases[i].height == height) {
+        *canvas = pool->canvases[i];
+        pool->canvases[i] = pool->canvases[--pool->count];
+        pthread_mutex_unlock(&pool->lock);
+
+        for (size_t p = 0; p < (size_t) width * height; p++) {
+          canvas->data[p] = 0x000000FFU;
+        }
+        return IMG_SUCCESS;
+      }
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return init_image(canvas, width, height);
+}
+
+// Give a canvas back to the pool (or free it, if there is no pool
+// or the pool is full, in which case the oldest one goes).
+void give_canvas(struct CanvasPool *pool, struct Image *canvas) {
+  if (canvas->data == NULL) {
+    return;
+  }
+  if (pool != NULL && pool->capacity > 0) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count == pool->capacity) {
+      free(pool->canvases[0].data);
+      memmove(pool->canvases, pool->canvases + 1, (pool->count - 1) * sizeof(struct Image));
+      pool->count--;
+    }
+    pool->canvases[pool->count++] = *canvas;
+    pthread_mutex_unlock(&pool->lock);
+  } else {
+    free(canvas->data);
+  }
+  canvas->data = NULL;
+}
 
-  struct Image loaded_images[NUM_IMAGE_SLOTS] = {{0,0,NULL}};
+// Read the commands of a scene into a display list, loading the
+// images it uses. Errors are printed.
+// Returns 1 if the whole scene was understood, 0 otherwise.
+int parse_scene(FILE *in, const struct RenderSettings *settings, struct Image *canvas,
+                struct DisplayList *scene, struct Image *loaded_images) {
   uint32_t width, height;
   char cmd;
   struct Rect rect;
@@ -47,57 +186,64 @@ int main(int argc, char **argv) {
 
   int error = 0;
 
-  while (!error && scanf(" %c", &cmd) == 1) {
+  while (!error && fscanf(in, " %c", &cmd) == 1) {
     switch (cmd) {
     case 'S': // "Size", must be the first command
-      if (scanf("%u %u", &width, &height) != 2) {
+      if (fscanf(in, "%u %u", &width, &height) != 2) {
         error = 1;
         fprintf(stderr, "Error: invalid C command\n");
         break;
       }
-      if (init_image(&canvas, width, height) != IMG_SUCCESS) {
+      // a new canvas replaces the old one and everything drawn on it
+      give_canvas(settings->pool, canvas);
+      free_display_list(scene);
+      if (take_canvas(settings->pool, canvas, width, height) != IMG_SUCCESS) {
         error = 1;
         fprintf(stderr, "Error: could not create canvas\n");
       }
       break;
 
     case 'R': // "Rectangle"
-      if (canvas.data == NULL) {
+      if (canvas->data == NULL) {
         error = 1;
         fprintf(stderr, "Error: image size must be specified before drawing operations\n");
-      } else if (scanf("%d %d %d %d %x", &rect.x, &rect.y, &rect.width, &rect.height, &color) != 5) {
+      } else if (fscanf(in, "%d %d %d %d %x", &rect.x, &rect.y, &rect.width, &rect.height, &color) != 5) {
         error = 1;
         fprintf(stderr, "Error: invalid rectangle\n");
-      } else {
-        draw_rect(&canvas, &rect, color);
+      } else if (record_rect(scene, &rect, color) != IMG_SUCCESS) {
+        error = 1;
+        fprintf(stderr, "Error: could not record command\n");
       }
       break;
 
     case 'C': // "Circle"
-      if (canvas.data == NULL) {
+      if (canvas->data == NULL) {
         error = 1;
         fprintf(stderr, "Error: image size must be specified before drawing operations\n");
-      } else if (scanf("%d %d %d %x", &x, &y, &r, &color) != 4) {
+      } else if (fscanf(in, "%d %d %d %x", &x, &y, &r, &color) != 4) {
         error = 1;
         fprintf(stderr, "Error: invalid circle\n");
-      } else {
-        draw_circle(&canvas, x, y, r, color);
+      } else if (record_circle(scene, x, y, r, color) != IMG_SUCCESS) {
+        error = 1;
+        fprintf(stderr, "Error: could not record command\n");
       }
       break;
 
     case 'L': // "Load"
-      if (scanf("%d", &n) != 1) {
+      if (fscanf(in, "%d", &n) != 1) {
         error = 1;
         fprintf(stderr, "Error: invalid image number\n");
       } else {
-        skipws(stdin);
-        if (scanf("%255s", filename) != 1) {
+        skipws(in);
+        if (fscanf(in, "%255s", filename) != 1) {
           error = 1;
           fprintf(stderr, "Error: error reading image filename\n");
         } else if (n < 0 || n >= NUM_IMAGE_SLOTS || loaded_images[n].data != NULL) {
           error = 1;
           fprintf(stderr, "Error: invalid image number\n");
-        } else if (read_image(filename, &loaded_images[n]) != IMG_SUCCESS) {
+        } else if (image_cache_load(settings->cache, filename, &loaded_images[n]) != IMG_SUCCESS) {
+          // loaded images are only ever drawn from, so the cache
+          // indexes them to let sprites skip their transparent pixels
           error = 1;
           fprintf(stderr, "Error: could not read image\n");
         }
@@ -105,26 +251,28 @@ int main(int argc, char **argv) {
       break;
 
     case 'T': // "Tile"
-      if (scanf("%d %d %d %d %d %d %d", &n, &rect.x, &rect.y, &rect.width, &rect.height, &x, &y) != 7) {
+      if (fscanf(in, "%d %d %d %d %d %d %d", &n, &rect.x, &rect.y, &rect.width, &rect.height, &x, &y) != 7) {
         error = 1;
         fprintf(stderr, "Error: invalid T command\n");
       } else if (n < 0 || n >= NUM_IMAGE_SLOTS || loaded_images[n].data == NULL) {
         error = 1;
         fprintf(stderr, "Error: invalid image number\n");
-      } else {
-        draw_tile(&canvas, x, y, &loaded_images[n], &rect);
+      } else if (record_tile(scene, x, y, &loaded_images[n], &rect) != IMG_SUCCESS) {
+        error = 1;
+        fprintf(stderr, "Error: could not record command\n");
       }
       break;
 
     case 'P': // "sPrite"
-      if (scanf("%d %d %d %d %d %d %d", &n, &rect.x, &rect.y, &rect.width, &rect.height, &x, &y) != 7) {
+      if (fscanf(in, "%d %d %d %d %d %d %d", &n, &rect.x, &rect.y, &rect.width, &rect.height, &x, &y) != 7) {
         error = 1;
         fprintf(stderr, "Error: invalid P command\n");
       } else if (n < 0 || n >= NUM_IMAGE_SLOTS || loaded_images[n].data == NULL) {
         error = 1;
         fprintf(stderr, "Error: invalid image number\n");
-      } else {
-        draw_sprite(&canvas, x, y, &loaded_images[n], &rect);
+      } else if (record_sprite(scene, x, y, &loaded_images[n], &rect) != IMG_SUCCESS) {
+        error = 1;
+        fprintf(stderr, "Error: could not record command\n");
       }
       break;
 
@@ -135,16 +283,276 @@ int main(int argc, char **argv) {
     }
   }
 
+  return !error;
+}
+
+// Parse, render, and encode one scene, timing each step.
+// Sets scene->error if any of them failed.
+void run_scene(struct Scene *scene, const struct RenderSettings *settings) {
+  struct Image canvas = {
+    .data = NULL,
+    .width = 0,
+    .height = 0,
+    .opacity = NULL,
+  };
+
+  // images are loaded through the cache, so slots that load the
+  // same file (in this scene or any other) share its pixels
+  struct Image loaded_images[NUM_IMAGE_SLOTS] = {{0,0,NULL,NULL}};
+
+  // commands are all recorded first, then rendered in parallel
+  struct DisplayList dl;
+  init_display_list(&dl);
+
+  double start = now_ms();
+  FILE *in = scene->input != NULL ? fopen(scene->input, "r") : stdin;
+  if (in == NULL) {
+    scene->error = 1;
+    fprintf(stderr, "Error: could not open %s\n", scene->input);
+  } else {
+    scene->error = !parse_scene(in, settings, &canvas, &dl, loaded_images);
+    if (in != stdin) {
+      fclose(in);
+    }
+  }
+  scene->parse_ms = now_ms() - start;
+
+  // drop commands that a later tile or opaque rectangle paints over
+  start = now_ms();
+  struct CullStats stats;
+  if (!scene->error && cull_occluded(&dl, &canvas, &stats) == IMG_SUCCESS && settings->print_stats) {
+    fprintf(stderr, "culled %u commands (%llu pixels), %u more were off the canvas\n",
+            stats.culled_commands, (unsigned long long) stats.culled_pixels, stats.offscreen_commands);
+  }
+
+  if (!scene->error) {
+    // bands need no extra memory, so they're the fallback
+    if (!settings->use_tiles || render_tiles(&canvas, &dl, settings->num_threads) != IMG_SUCCESS) {
+      render_bands(&canvas, &dl, settings->num_threads);
+    }
+  }
+  scene->render_ms = now_ms() - start;
+
   // try to write output file
-  if (!error && write_image(argv[1], &canvas) != IMG_SUCCESS) {
-    error = 1;
+  start = now_ms();
+  if (!scene->error && write_image_ex(scene->output, &canvas, &settings->png_options) != IMG_SUCCESS) {
+    scene->error = 1;
     fprintf(stderr, "Error: could not write image\n");
   }
+  scene->encode_ms = now_ms() - start;
 
-  free(canvas.data);
+  free_display_list(&dl);
+  give_canvas(settings->pool, &canvas);
   for (int i = 0; i < NUM_IMAGE_SLOTS; i++) {
-    free(loaded_images[i].data);
+    image_cache_release(settings->cache, &loaded_images[i]);
+  }
+}
+
+// Read a batch manifest: one scene per line, its input file and
+// output PNG separated by whitespace. Blank lines and lines
+// starting with # are skipped.
+// Returns the number of scenes (and sets *scenes), or -1 if the
+// manifest can't be read.
+int read_manifest(const char *filename, struct Scene **scenes) {
+  FILE *in = fopen(filename, "r");
+  if (in == NULL) {
+    return -1;
+  }
+
+  int count = 0, capacity = 16;
+  struct Scene *list = (struct Scene *) malloc(capacity * sizeof(struct Scene));
+  char line[MAX_MANIFEST_LINE], input[MAX_MANIFEST_LINE], output[MAX_MANIFEST_LINE];
+  int ok = list != NULL;
+  while (ok && fgets(line, sizeof(line), in) != NULL) {
+    char *start = line;
+    while (isspace((unsigned char) *start)) {
+      start++;
+    }
+    if (*start == '\0' || *start == '#') {
+      continue;
+    }
+
+    char extra;
+    if (sscanf(start, "%s %s %c", input, output, &extra) != 2) {
+      ok = 0;
+      break;
+    }
+    if (count == capacity) {
+      capacity *= 2;
+      struct Scene *grown = (struct Scene *) realloc(list, capacity * sizeof(struct Scene));
+      if (grown == NULL) {
+        ok = 0;
+        break;
+      }
+      list = grown;
+    }
+    struct Scene *scene = &list[count];
+    memset(scene, 0, sizeof(*scene));
+    scene->input = strdup(input);
+    scene->output = strdup(output);
+    count++;
+    ok = scene->input != NULL && scene->output != NULL;
+  }
+  fclose(in);
+
+  if (!ok) {
+    for (int i = 0; i < count; i++) {
+      free((char *) list[i].input);
+      free((char *) list[i].output);
+    }
+    free(list);
+    return -1;
+  }
+  *scenes = list;
+  return count;
+}
+
+// state of a batch being rendered
+struct Batch {
+  struct Scene *scenes;
+  const struct RenderSettings *settings;
+};
+
+// Runs one scene of a batch (a parallel_for work function).
+void run_batch_scene(void *arg, uint32_t index) {
+  struct Batch *batch = (struct Batch *) arg;
+  run_scene(&batch->scenes[index], batch->settings);
+}
+
+// Render every scene of a manifest. Scenes run in parallel, each
+// one parsing, rendering, and encoding in turn, so while one scene
+// is being encoded the next ones are already being parsed and
+// rendered. The threads are split between scenes first, and what
+// is left over renders and encodes within each scene.
+// Returns 0 if every scene succeeded, 1 otherwise.
+int run_batch(const char *manifest, struct RenderSettings *settings) {
+  struct Scene *scenes;
+  int count = read_manifest(manifest, &scenes);
+  if (count < 0) {
+    fprintf(stderr, "Error: could not read manifest %s\n", manifest);
+    return 1;
+  }
+
+  uint32_t total_threads = settings->num_threads;
+  uint32_t workers = total_threads < (uint32_t) count ? total_threads : (uint32_t) count;
+  if (workers == 0) {
+    workers = 1;
+  }
+  settings->num_threads = total_threads / workers;
+  if (settings->png_options.threads > settings->num_threads) {
+    settings->png_options.threads = settings->num_threads;
+  }
+
+  // enough canvases for every worker to find one of its size
+  struct CanvasPool pool = { .canvases = NULL, .count = 0, .capacity = workers };
+  pool.canvases = (struct Image *) malloc(workers * sizeof(struct Image));
+  if (pool.canvases == NULL) {
+    pool.capacity = 0;
+  }
+  pthread_mutex_init(&pool.lock, NULL);
+  settings->pool = &pool;
+
+  double start = now_ms();
+  struct Batch batch = { .scenes = scenes, .settings = settings };
+  parallel_for((uint32_t) count, workers, run_batch_scene, &batch);
+  double elapsed = now_ms() - start;
+
+  // per-scene timings, in manifest order
+  int failed = 0;
+  for (int i = 0; i < count; i++) {
+    fprintf(stderr, "%s -> %s: parse %.2f ms, render %.2f ms, encode %.2f ms%s\n",
+            scenes[i].input, scenes[i].output, scenes[i].parse_ms, scenes[i].render_ms,
+            scenes[i].encode_ms, scenes[i].error ? " (failed)" : "");
+    failed += scenes[i].error;
+    free((char *) scenes[i].input);
+    free((char *) scenes[i].output);
+  }
+  fprintf(stderr, "%d scenes (%d failed) in %.2f ms on %u threads\n", count, failed, elapsed, total_threads);
+
+  for (uint32_t i = 0; i < pool.count; i++) {
+    free(pool.canvases[i].data);
+  }
+  free(pool.canvases);
+  pthread_mutex_destroy(&pool.lock);
+  free(scenes);
+
+  return failed != 0;
+}
+
+int main(int argc, char **argv) {
+  // usage: c_draw [-c MiB] [-j threads] [-r tiles|bands] [-s] [-z png options] output.png
+  //    or: c_draw -b manifest [options]
+  // (-b renders every scene of a manifest, see read_manifest,
+  // -c limits the cache of decoded images, -s prints what
+  // occlusion culling removed and how the cache did, -z is
+  // described at parse_png_options, e.g. -z preview or
+  // -z level=9,filter=max)
+  size_t cache_bytes = (size_t) DEFAULT_CACHE_MIB << 20;
+  const char *manifest = NULL;
+  struct RenderSettings settings = {
+    .num_threads = parallel_default_threads(),
+    .use_tiles = 1,
+    .print_stats = 0,
+    .png_options = PNG_WRITE_DEFAULT,
+    .cache = NULL,
+    .pool = NULL,
+  };
+  int opt;
+  while ((opt = getopt(argc, argv, "b:c:j:r:sz:")) != -1) {
+    if (opt == 'b') {
+      manifest = optarg;
+    } else if (opt == 'c' && atoi(optarg) >= 0) {
+      cache_bytes = (size_t) atoi(optarg) << 20;
+    } else if (opt == 'j' && atoi(optarg) > 0) {
+      settings.num_threads = (uint32_t) atoi(optarg);
+    } else if (opt == 'r' && strcmp(optarg, "tiles") == 0) {
+      settings.use_tiles = 1;
+    } else if (opt == 'r' && strcmp(optarg, "bands") == 0) {
+      settings.use_tiles = 0;
+    } else if (opt == 's') {
+      settings.print_stats = 1;
+    } else if (opt == 'z') {
+      if (!parse_png_options(optarg, &settings.png_options)) {
+        fprintf(stderr, "Error: invalid PNG options\n");
+        return 1;
+      }
+    } else {
+      fprintf(stderr, "Error: invalid command line arguments\n");
+      return 1;
+    }
+  }
+  if (argc - optind != (manifest != NULL ? 0 : 1)) {
+    fprintf(stderr, "Error: invalid command line arguments\n");
+    return 1;
+  }
+
+  // unless -z says otherwise, encode with as many threads as render
+  if (settings.png_options.threads == 0) {
+    settings.png_options.threads = settings.num_threads;
+  }
+
+  if (image_cache_create(&settings.cache, cache_bytes) != IMG_SUCCESS) {
+    fprintf(stderr, "Error: could not create image cache\n");
+    return 1;
+  }
+
+  int error;
+  if (manifest != NULL) {
+    error = run_batch(manifest, &settings);
+  } else {
+    struct Scene scene = { .input = NULL, .output = argv[optind] };
+    run_scene(&scene, &settings);
+    error = scene.error;
+  }
+
+  if (settings.print_stats) {
+    struct ImageCacheStats cache_stats;
+    image_cache_stats(settings.cache, &cache_stats);
+    fprintf(stderr, "image cache: %llu hits, %llu misses, %llu evictions, %u images (%zu bytes)\n",
+            (unsigned long long) cache_stats.hits, (unsigned long long) cache_stats.misses,
+            (unsigned long long) cache_stats.evictions, cache_stats.images, cache_stats.bytes);
   }
+  image_cache_destroy(settings.cache);
 
   return (error != 0); // returns 0 IFF there was no error
 }
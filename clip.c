@@ -0,0 +1,70 @@
+/*
+ * Rectangle clipping helpers
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+#include "clip.h"
+
+//
+// Clips a rectangle to the bounds of an image.
+//
+// Parameters:
+//   img  - pointer to struct Image
+//   rect - pointer to struct Rect to clip
+//   out  - pointer to struct Rect that receives the clipped rectangle
+//
+// Returns:
+//   1 if the clipped rectangle contains at least one pixel, 0 otherwise.
+//
+int32_t clip_rect(const struct Image *img, const struct Rect *rect, struct Rect *out) {
+  // use 64 bit math so that x + width can't overflow
+  int64_t x_start = rect->x;
+  int64_t y_start = rect->y;
+  int64_t x_end = x_start + rect->width;
+  int64_t y_end = y_start + rect->height;
+
+  if (x_start < 0) {
+    x_start = 0;
+  }
+  if (y_start < 0) {
+    y_start = 0;
+  }
+  if (x_end > img->width) {
+    x_end = img->width;
+  }
+  if (y_end > img->height) {
+    y_end = img->height;
+  }
+
+  if (x_start >= x_end || y_start >= y_end) {
+    return 0;
+  }
+
+  out->x = x_start;
+  out->y = y_start;
+  out->width = x_end - x_start;
+  out->height = y_end - y_start;
+  return 1;
+}
+
+//
+// Checks whether a rectangle lies entirely within the bounds of an image.
+//
+// Parameters:
+//   img  - pointer to struct Image
+//   rect - pointer to struct Rect
+//
+// Returns:
+//   1 if every pixel of a non-empty rect is in bounds, 0 otherwise.
+//
+int32_t rect_in_bounds(const struct Image *img, const struct Rect *rect) {
+  if (rect->width <= 0 || rect->height <= 0 || rect->x < 0 || rect->y < 0) {
+    return 0;
+  }
+  return (int64_t) rect->x + rect->width <= img->width
+      && (int64_t) rect->y + rect->height <= img->height;
+}
@@ -0,0 +1,37 @@
+/*
+ * Rectangle clipping helpers
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef CLIP_H
+#define CLIP_H
+
+#include <stdint.h>
+#include "image.h"
+#include "drawing_funcs.h"
+
+// Clip a rectangle to the bounds of an image.
+//
+// Parameters:
+//   img - pointer to struct Image
+//   rect - pointer to struct Rect to clip
+//   out - pointer to struct Rect that receives the clipped rectangle
+//
+// Returns:
+//   1 if the clipped rectangle contains at least one pixel, 0 otherwise
+int32_t clip_rect(const struct Image *img, const struct Rect *rect, struct Rect *out);
+
+// Check whether a rectangle lies entirely within the bounds of an image.
+//
+// Parameters:
+//   img - pointer to struct Image
+//   rect - pointer to struct Rect
+//
+// Returns:
+//   1 if every pixel of a non-empty rect is in bounds, 0 otherwise
+int32_t rect_in_bounds(const struct Image *img, const struct Rect *rect);
+
+#endif // CLIP_H
@@ -0,0 +1,143 @@
+/*
+ * Occlusion culling of display lists
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+#include <stdlib.h>
+#include "cull.h"
+#include "clip.h"
+
+// occluders are filed in a grid of cells this size, so a command
+// is only tested against the occluders that share a cell with its
+// top left pixel
+#define CULL_CELL_SIZE 64
+
+// an occluder filed in one grid cell (cells hold linked lists)
+struct OccluderNode {
+  struct Rect rect;
+  int32_t next;  // index of the next node in the cell, or -1
+};
+
+// grid of the occluders seen so far (all later in the list)
+struct OccluderGrid {
+  uint32_t cols, rows;
+  int32_t *head;  // first node of each cell, or -1
+  struct OccluderNode *nodes;
+  uint32_t num_nodes, capacity;
+};
+
+//
+// Checks whether a command replaces every pixel it covers.
+//
+static int32_t is_opaque_write(const struct DrawCommand *cmd) {
+  return cmd->kind == 'T' || (cmd->kind == 'R' && (cmd->color & 0xFF) == 0xFF);
+}
+
+//
+// Checks whether rectangle inner lies entirely inside rectangle outer.
+//
+static int32_t rect_contains(const struct Rect *outer, const struct Rect *inner) {
+  return inner->x >= outer->x && inner->y >= outer->y
+      && inner->x + inner->width <= outer->x + outer->width
+      && inner->y + inner->height <= outer->y + outer->height;
+}
+
+//
+// Checks whether an on-image rectangle is hidden by an occluder.
+//
+static int32_t is_occluded(const struct OccluderGrid *grid, const struct Rect *rect) {
+  uint32_t cell = (rect->y / CULL_CELL_SIZE) * grid->cols + rect->x / CULL_CELL_SIZE;
+  for (int32_t n = grid->head[cell]; n != -1; n = grid->nodes[n].next) {
+    if (rect_contains(&grid->nodes[n].rect, rect)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+//
+// Files an on-image rectangle in every cell it overlaps.
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+//
+static int add_occluder(struct OccluderGrid *grid, const struct Rect *rect) {
+  uint32_t cx_start = rect->x / CULL_CELL_SIZE;
+  uint32_t cy_start = rect->y / CULL_CELL_SIZE;
+  uint32_t cx_end = (rect->x + rect->width - 1) / CULL_CELL_SIZE + 1;
+  uint32_t cy_end = (rect->y + rect->height - 1) / CULL_CELL_SIZE + 1;
+
+  for (uint32_t cy = cy_start; cy < cy_end; cy++) {
+    for (uint32_t cx = cx_start; cx < cx_end; cx++) {
+      if (grid->num_nodes == grid->capacity) {
+        uint32_t capacity = grid->capacity ? grid->capacity * 2 : 256;
+        if (capacity > INT32_MAX) {
+          return IMG_ERR_MALLOC_FAILED;
+        }
+        struct OccluderNode *grown = (struct OccluderNode *) realloc(grid->nodes, capacity * sizeof(struct OccluderNode));
+        if (grown == NULL) {
+          return IMG_ERR_MALLOC_FAILED;
+        }
+        grid->nodes = grown;
+        grid->capacity = capacity;
+      }
+
+      uint32_t cell = cy * grid->cols + cx;
+      grid->nodes[grid->num_nodes].rect = *rect;
+      grid->nodes[grid->num_nodes].next = grid->head[cell];
+      grid->head[cell] = (int32_t) grid->num_nodes++;
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+int cull_occluded(struct DisplayList *dl, const struct Image *img, struct CullStats *stats) {
+  struct CullStats counts = { 0, 0, 0 };
+  struct OccluderGrid grid = { 0, 0, NULL, NULL, 0, 0 };
+  grid.cols = (img->width + CULL_CELL_SIZE - 1) / CULL_CELL_SIZE;
+  grid.rows = (img->height + CULL_CELL_SIZE - 1) / CULL_CELL_SIZE;
+  uint64_t num_cells = (uint64_t) grid.cols * grid.rows;
+
+  grid.head = (int32_t *) malloc(num_cells * sizeof(int32_t) + 1);
+  uint8_t *keep = (uint8_t *) malloc(dl->count + 1);
+  int result = grid.head != NULL && keep != NULL ? IMG_SUCCESS : IMG_ERR_MALLOC_FAILED;
+  for (uint64_t c = 0; result == IMG_SUCCESS && c < num_cells; c++) {
+    grid.head[c] = -1;
+  }
+
+  // back to front, so the occluders in the grid all come later
+  for (uint32_t i = dl->count; result == IMG_SUCCESS && i-- > 0; ) {
+    const struct DrawCommand *cmd = &dl->cmds[i];
+    struct Rect visible;
+    keep[i] = 0;
+
+    if (cmd->bounds.width <= 0 || cmd->bounds.height <= 0 ||
+        !clip_rect(img, &cmd->bounds, &visible)) {
+      counts.offscreen_commands++;
+    } else if (is_occluded(&grid, &visible)) {
+      counts.culled_commands++;
+      counts.culled_pixels += (uint64_t) visible.width * visible.height;
+    } else {
+      keep[i] = 1;
+      if (is_opaque_write(cmd)) {
+        result = add_occluder(&grid, &visible);
+      }
+    }
+  }
+
+  if (result == IMG_SUCCESS) {
+    filter_display_list(dl, keep);
+    if (stats != NULL) {
+      *stats = counts;
+    }
+  }
+
+  free(keep);
+  free(grid.head);
+  free(grid.nodes);
+  return result;
+}
@@ -0,0 +1,43 @@
+/*
+ * Occlusion culling of display lists
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef CULL_H
+#define CULL_H
+
+#include <stdint.h>
+#include "image.h"
+#include "display_list.h"
+
+// What cull_occluded removed from a display list.
+struct CullStats {
+  uint32_t culled_commands;    // commands hidden by a later opaque write
+  uint64_t culled_pixels;      // on-image pixels those commands covered
+  uint32_t offscreen_commands; // commands that couldn't touch the image
+};
+
+// Remove the commands of a display list that can't change the
+// final image when it is replayed onto img at the origin. A tile,
+// or a rectangle with alpha 0xFF, replaces every pixel it covers
+// whatever was there before, so any earlier command whose on-image
+// bounds lie entirely inside one of them is dropped, as is any
+// command that can't touch the image at all. The list is walked
+// back to front, so chains of repainted cells collapse to the
+// last write.
+//
+// Parameters:
+//   dl - pointer to DisplayList to cull
+//   img - pointer to the Image the list will be replayed onto
+//         (only its size is used)
+//   stats - pointer to CullStats to fill in (may be NULL)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+//   (in which case the list is unchanged)
+int cull_occluded(struct DisplayList *dl, const struct Image *img, struct CullStats *stats);
+
+#endif // CULL_H
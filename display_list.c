@@ -0,0 +1,201 @@
+/*
+ * Display lists of recorded drawing commands
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+#include <stdlib.h>
+#include "display_list.h"
+#include "clip.h"
+
+//
+// Builds a rectangle from its (exclusive) edges, clamped to what a
+// Rect can hold. Returns an empty rectangle if there are no pixels.
+//
+static struct Rect make_bounds(int64_t x_start, int64_t y_start, int64_t x_end, int64_t y_end) {
+  struct Rect bounds = { 0, 0, 0, 0 };
+  if (x_start < INT32_MIN) {
+    x_start = INT32_MIN;
+  }
+  if (y_start < INT32_MIN) {
+    y_start = INT32_MIN;
+  }
+  if (x_end - x_start > INT32_MAX) {
+    x_end = x_start + INT32_MAX;
+  }
+  if (y_end - y_start > INT32_MAX) {
+    y_end = y_start + INT32_MAX;
+  }
+
+  if (x_end > x_start && y_end > y_start) {
+    bounds.x = (int32_t) x_start;
+    bounds.y = (int32_t) y_start;
+    bounds.width = (int32_t) (x_end - x_start);
+    bounds.height = (int32_t) (y_end - y_start);
+  }
+  return bounds;
+}
+
+static inline int64_t min64(int64_t a, int64_t b) {
+  return a < b ? a : b;
+}
+
+static inline int64_t max64(int64_t a, int64_t b) {
+  return a > b ? a : b;
+}
+
+//
+// Checks whether a rectangle has no pixels.
+//
+static int32_t rect_is_empty(const struct Rect *rect) {
+  return rect->width <= 0 || rect->height <= 0;
+}
+
+//
+// Grows the bounds of a display list to include a rectangle.
+//
+static void grow_bounds(struct DisplayList *dl, const struct Rect *b) {
+  if (rect_is_empty(b)) {
+    // nothing to add
+  } else if (rect_is_empty(&dl->bounds)) {
+    dl->bounds = *b;
+  } else {
+    struct Rect *u = &dl->bounds;
+    int64_t x_start = min64(b->x, u->x);
+    int64_t y_start = min64(b->y, u->y);
+    int64_t x_end = max64((int64_t) b->x + b->width, (int64_t) u->x + u->width);
+    int64_t y_end = max64((int64_t) b->y + b->height, (int64_t) u->y + u->height);
+    *u = make_bounds(x_start, y_start, x_end, y_end);
+  }
+}
+
+//
+// Appends a command to a display list and grows the list's bounds.
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+//
+static int add_command(struct DisplayList *dl, const struct DrawCommand *cmd) {
+  if (dl->count == dl->capacity) {
+    uint32_t capacity = dl->capacity ? dl->capacity * 2 : 64;
+    struct DrawCommand *grown = (struct DrawCommand *) realloc(dl->cmds, capacity * sizeof(struct DrawCommand));
+    if (grown == NULL) {
+      return IMG_ERR_MALLOC_FAILED;
+    }
+    dl->cmds = grown;
+    dl->capacity = capacity;
+  }
+  dl->cmds[dl->count++] = *cmd;
+
+  grow_bounds(dl, &cmd->bounds);
+  return IMG_SUCCESS;
+}
+
+//
+// Bounds of a tile or sprite drawn at (x, y); the drawing functions
+// draw nothing if the tile/sprite isn't entirely inside its image.
+//
+static struct Rect blit_bounds(const struct Image *src, const struct Rect *rect, int32_t x, int32_t y) {
+  if (!rect_in_bounds(src, rect)) {
+    return make_bounds(0, 0, 0, 0);
+  }
+  return make_bounds(x, y, (int64_t) x + rect->width, (int64_t) y + rect->height);
+}
+
+void init_display_list(struct DisplayList *dl) {
+  dl->cmds = NULL;
+  dl->count = 0;
+  dl->capacity = 0;
+  dl->bounds = make_bounds(0, 0, 0, 0);
+}
+
+void free_display_list(struct DisplayList *dl) {
+  free(dl->cmds);
+  init_display_list(dl);
+}
+
+int record_rect(struct DisplayList *dl, const struct Rect *rect, uint32_t color) {
+  struct DrawCommand cmd = { .kind = 'R', .rect = *rect, .color = color };
+  cmd.bounds = make_bounds(rect->x, rect->y,
+                           (int64_t) rect->x + rect->width, (int64_t) rect->y + rect->height);
+  return add_command(dl, &cmd);
+}
+
+int record_circle(struct DisplayList *dl, int32_t x, int32_t y, int32_t r, uint32_t color) {
+  struct DrawCommand cmd = { .kind = 'C', .x = x, .y = y, .r = r, .color = color };
+  // pixels at distance r are part of the circle
+  cmd.bounds = make_bounds((int64_t) x - r, (int64_t) y - r,
+                           (int64_t) x + r + 1, (int64_t) y + r + 1);
+  return add_command(dl, &cmd);
+}
+
+int record_tile(struct DisplayList *dl, int32_t x, int32_t y,
+                struct Image *tilemap, const struct Rect *tile) {
+  struct DrawCommand cmd = { .kind = 'T', .rect = *tile, .x = x, .y = y, .src = tilemap };
+  cmd.bounds = blit_bounds(tilemap, tile, x, y);
+  return add_command(dl, &cmd);
+}
+
+int record_sprite(struct DisplayList *dl, int32_t x, int32_t y,
+                  struct Image *spritemap, const struct Rect *sprite) {
+  struct DrawCommand cmd = { .kind = 'P', .rect = *sprite, .x = x, .y = y, .src = spritemap };
+  cmd.bounds = blit_bounds(spritemap, sprite, x, y);
+  return add_command(dl, &cmd);
+}
+
+void filter_display_list(struct DisplayList *dl, const uint8_t *keep) {
+  uint32_t count = 0;
+  dl->bounds = make_bounds(0, 0, 0, 0);
+  for (uint32_t i = 0; i < dl->count; i++) {
+    if (keep[i]) {
+      dl->cmds[count++] = dl->cmds[i];
+      grow_bounds(dl, &dl->cmds[i].bounds);
+    }
+  }
+  dl->count = count;
+}
+
+void replay_command(struct Image *img, const struct DrawCommand *cmd, int32_t x0, int32_t y0) {
+  // part of the command's bounds that lands on the image
+  const struct Rect *b = &cmd->bounds;
+  struct Rect visible = make_bounds(max64(b->x, x0), max64(b->y, y0),
+                                    min64((int64_t) b->x + b->width, (int64_t) x0 + img->width),
+                                    min64((int64_t) b->y + b->height, (int64_t) y0 + img->height));
+  if (rect_is_empty(b) || rect_is_empty(&visible)) {
+    return;
+  }
+
+  struct Rect rect = cmd->rect;
+  int32_t x = (int32_t) ((int64_t) cmd->x - x0);
+  int32_t y = (int32_t) ((int64_t) cmd->y - y0);
+
+  switch (cmd->kind) {
+  case 'R':
+    // a rectangle is its own bounds, so draw the visible part,
+    // which keeps the translated coordinates in range
+    rect.x = (int32_t) ((int64_t) visible.x - x0);
+    rect.y = (int32_t) ((int64_t) visible.y - y0);
+    rect.width = visible.width;
+    rect.height = visible.height;
+    draw_rect(img, &rect, cmd->color);
+    break;
+  case 'C':
+    draw_circle(img, x, y, cmd->r, cmd->color);
+    break;
+  case 'T':
+    draw_tile(img, x, y, cmd->src, &rect);
+    break;
+  case 'P':
+    draw_sprite(img, x, y, cmd->src, &rect);
+    break;
+  }
+}
+
+void replay_display_list(struct Image *img, const struct DisplayList *dl, int32_t x0, int32_t y0) {
+  for (uint32_t i = 0; i < dl->count; i++) {
+    replay_command(img, &dl->cmds[i], x0, y0);
+  }
+}
@@ -0,0 +1,132 @@
+/*
+ * Display lists of recorded drawing commands
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef DISPLAY_LIST_H
+#define DISPLAY_LIST_H
+
+#include <stdint.h>
+#include "image.h"
+#include "drawing_funcs.h"
+
+// One recorded draw_rect, draw_circle, draw_tile, or draw_sprite call.
+struct DrawCommand {
+  char kind;           // 'R', 'C', 'T', or 'P', as in the input file
+  struct Rect rect;    // the rectangle (R) or the tile/sprite (T, P)
+  int32_t x, y;        // circle center (C) or destination (T, P)
+  int32_t r;           // circle radius (C)
+  uint32_t color;      // color (R, C)
+  struct Image *src;   // tilemap or spritemap (T, P)
+  struct Rect bounds;  // every pixel the command can touch (empty
+                       // if it draws nothing, whatever the canvas)
+};
+
+// A list of drawing commands, recorded in order, that can be
+// replayed onto any image any number of times. Tilemaps and
+// spritemaps are not copied, so they must outlive the list.
+struct DisplayList {
+  struct DrawCommand *cmds;
+  uint32_t count;
+  uint32_t capacity;
+  struct Rect bounds;  // union of the bounds of all the commands
+};
+
+// Initialize an empty display list.
+//
+// Parameters:
+//   dl - pointer to DisplayList to initialize
+void init_display_list(struct DisplayList *dl);
+
+// Free the memory owned by a display list (but not the images
+// its commands draw from), leaving it empty.
+//
+// Parameters:
+//   dl - pointer to DisplayList to free
+void free_display_list(struct DisplayList *dl);
+
+// Record a draw_rect call.
+//
+// Parameters:
+//   dl - pointer to DisplayList
+//   rect - pointer to Rect
+//   color - uint32_t color value
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+int record_rect(struct DisplayList *dl, const struct Rect *rect, uint32_t color);
+
+// Record a draw_circle call.
+//
+// Parameters:
+//   dl - pointer to DisplayList
+//   x - x coordinate of circle's center
+//   y - y coordinate of circle's center
+//   r - radius of circle
+//   color - uint32_t color value
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+int record_circle(struct DisplayList *dl, int32_t x, int32_t y, int32_t r, uint32_t color);
+
+// Record a draw_tile call.
+//
+// Parameters:
+//   dl - pointer to DisplayList
+//   x - x coordinate of location where tile should be copied
+//   y - y coordinate of location where tile should be copied
+//   tilemap - pointer to Image (the tilemap)
+//   tile - pointer to Rect (the tile)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+int record_tile(struct DisplayList *dl, int32_t x, int32_t y,
+                struct Image *tilemap, const struct Rect *tile);
+
+// Record a draw_sprite call.
+//
+// Parameters:
+//   dl - pointer to DisplayList
+//   x - x coordinate of location where sprite should be copied
+//   y - y coordinate of location where sprite should be copied
+//   spritemap - pointer to Image (the spritemap)
+//   sprite - pointer to Rect (the sprite)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+int record_sprite(struct DisplayList *dl, int32_t x, int32_t y,
+                  struct Image *spritemap, const struct Rect *sprite);
+
+// Remove commands from a display list, keeping the order of
+// the rest.
+//
+// Parameters:
+//   dl - pointer to DisplayList
+//   keep - array with one entry per command, nonzero to keep it
+void filter_display_list(struct DisplayList *dl, const uint8_t *keep);
+
+// Draw one recorded command. The image's top left pixel stands
+// for the point (x0, y0) of the recorded coordinates, so a window
+// of a larger scene can be drawn onto a smaller image.
+//
+// Parameters:
+//   img - pointer to Image (dest image)
+//   cmd - pointer to the command to draw
+//   x0 - recorded x coordinate of the image's left column
+//   y0 - recorded y coordinate of the image's top row
+void replay_command(struct Image *img, const struct DrawCommand *cmd, int32_t x0, int32_t y0);
+
+// Draw every command of a display list in recorded order,
+// the same way as replay_command.
+//
+// Parameters:
+//   img - pointer to Image (dest image)
+//   dl - pointer to DisplayList
+//   x0 - recorded x coordinate of the image's left column
+//   y0 - recorded y coordinate of the image's top row
+void replay_display_list(struct Image *img, const struct DisplayList *dl, int32_t x0, int32_t y0);
+
+#endif // DISPLAY_LIST_H
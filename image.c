@@ -1,13 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "pnglite.h"
+#include "pnglite_simd.h"
 #include "image.h"
+#include "parallel.h"
+
+// the byte order is known when compiling, so nothing has to test it per pixel
+#define IMG_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
 
 int png_init_called;
 
 int is_little_endian(void) {
-  int32_t x = 1;
-  return *((char *) &x) == 1;
+  return IMG_LITTLE_ENDIAN;
 }
 
 uint32_t byteswap(uint32_t val) {
@@ -33,10 +42,192 @@ int init_image(struct Image *img, uint32_t width, uint32_t height) {
   img->width = width;
   img->height = height;
   img->data = pixel_data;
+  img->opacity = NULL;
+  img->mapping = NULL;
+  return IMG_SUCCESS;
+}
+
+// header of a .rgba file, 64 bytes so the rows after it stay
+// aligned in a mapping
+struct RgbaHeader {
+  char magic[8];        // RGBA_MAGIC
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;      // RGBA_FORMAT_PIXEL32
+  uint32_t byte_order;  // RGBA_BYTE_ORDER, in the byte order of the pixels
+  uint32_t stride;      // bytes from one row to the next
+  uint32_t reserved[9];
+};
+
+_Static_assert(sizeof(struct RgbaHeader) == 64, "the .rgba header is 64 bytes");
+
+// pixels are uint32_t values, R in the most significant byte
+#define RGBA_FORMAT_PIXEL32 1
+// reads back differently if the file came from a system with the
+// other byte order
+#define RGBA_BYTE_ORDER 0x01020304U
+// rows (and so the mapping of each row) start on a cache line
+#define RGBA_ROW_ALIGN 64
+
+// a mapped .rgba file
+struct ImageMapping {
+  void *addr;
+  size_t length;
+};
+
+//
+// Loads a .rgba file, returning IMG_ERR_COULD_NOT_OPEN if it
+// isn't one.
+//
+static int read_rgba_image(const char *filename, struct Image *img) {
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(struct RgbaHeader)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  // private and writable: drawing onto the image copies the pages
+  // it touches, and the file never changes
+  size_t length = (size_t) st.st_size;
+  void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  const struct RgbaHeader *header = (const struct RgbaHeader *) addr;
+  int swapped = header->byte_order != RGBA_BYTE_ORDER;
+  uint32_t width = header->width, height = header->height, stride = header->stride;
+  uint32_t format = header->format;
+  if (swapped) {
+    width = byteswap(width);
+    height = byteswap(height);
+    stride = byteswap(stride);
+    format = byteswap(format);
+  }
+  if (memcmp(header->magic, RGBA_MAGIC, 8) != 0 || format != RGBA_FORMAT_PIXEL32 ||
+      (swapped && header->byte_order != byteswap(RGBA_BYTE_ORDER)) ||
+      stride == 0 || stride / 4 < width || stride % RGBA_ROW_ALIGN != 0 ||
+      (length - sizeof(struct RgbaHeader)) / stride < height) {
+    munmap(addr, length);
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  uint32_t *rows = (uint32_t *) ((char *) addr + sizeof(struct RgbaHeader));
+  if (stride == width * sizeof(uint32_t) && !swapped) {
+    // the image is the mapping
+    struct ImageMapping *mapping = (struct ImageMapping *) malloc(sizeof(struct ImageMapping));
+    if (mapping == NULL) {
+      munmap(addr, length);
+      return IMG_ERR_MALLOC_FAILED;
+    }
+    mapping->addr = addr;
+    mapping->length = length;
+
+    img->data = rows;
+    img->mapping = mapping;
+  } else {
+    // padded (or foreign) rows are copied out
+    uint32_t *pixels = (uint32_t *) malloc((size_t) width * height * sizeof(uint32_t));
+    if (pixels == NULL) {
+      munmap(addr, length);
+      return IMG_ERR_MALLOC_FAILED;
+    }
+    for (uint32_t y = 0; y < height; y++) {
+      const uint32_t *src = (const uint32_t *) ((const char *) rows + (size_t) y * stride);
+      uint32_t *dst = pixels + (size_t) y * width;
+      if (swapped) {
+        for (uint32_t x = 0; x < width; x++) {
+          dst[x] = byteswap(src[x]);
+        }
+      } else {
+        memcpy(dst, src, width * sizeof(uint32_t));
+      }
+    }
+    munmap(addr, length);
+
+    img->data = pixels;
+    img->mapping = NULL;
+  }
+
+  img->width = width;
+  img->height = height;
+  img->opacity = NULL;
   return IMG_SUCCESS;
 }
 
+int write_rgba_image(const char *filename, const struct Image *img) {
+  uint32_t row_bytes = img->width * sizeof(uint32_t);
+  uint32_t stride = (row_bytes + RGBA_ROW_ALIGN - 1) / RGBA_ROW_ALIGN * RGBA_ROW_ALIGN;
+  struct RgbaHeader header = {
+    .width = img->width, .height = img->height, .format = RGBA_FORMAT_PIXEL32,
+    .byte_order = RGBA_BYTE_ORDER, .stride = stride,
+  };
+  memcpy(header.magic, RGBA_MAGIC, 8);
+
+  FILE *out = fopen(filename, "wb");
+  if (out == NULL) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  static const unsigned char padding[RGBA_ROW_ALIGN];
+  int ok = fwrite(&header, sizeof(header), 1, out) == 1;
+  for (uint32_t y = 0; ok && y < img->height; y++) {
+    ok = fwrite(img->data + (size_t) y * img->width, 1, row_bytes, out) == row_bytes &&
+         fwrite(padding, 1, stride - row_bytes, out) == stride - row_bytes;
+  }
+  if (fclose(out) != 0) {
+    ok = 0;
+  }
+
+  return ok ? IMG_SUCCESS : IMG_ERR_COULD_NOT_WRITE;
+}
+
+void free_image(struct Image *img) {
+  if (img->mapping != NULL) {
+    munmap(img->mapping->addr, img->mapping->length);
+    free(img->mapping);
+    img->mapping = NULL;
+  } else {
+    free(img->data);
+  }
+  img->data = NULL;
+}
+
+// where decoded rows go while an image is being read
+struct ReadTarget {
+  uint32_t *pixel_data;
+  uint32_t width;
+  unsigned bpp;  // 3 for RGB, 4 for RGBA
+};
+
+//
+// Converts one decoded PNG row straight into truecolor RGBA pixels.
+//
+static int store_row(unsigned char *row, unsigned y, void *user_pointer) {
+  struct ReadTarget *target = (struct ReadTarget *) user_pointer;
+  uint32_t *out = target->pixel_data + (size_t) y * target->width;
+
+  if (target->bpp == 3) {
+    // PNG pixel data is in RGB form, expand it to add the alpha channel
+    png_rgb_to_pixels(row, out, target->width);
+  } else {
+    // RGBA bytes are big-endian, so they are byteswapped on a
+    // little-endian system
+    png_rgba_to_pixels(row, out, target->width);
+  }
+
+  return PNG_NO_ERROR;
+}
+
 int read_image(const char *filename, struct Image *img) {
+  return read_image_ex(filename, img, &PNG_READ_DEFAULT);
+}
+
+int read_image_ex(const char *filename, struct Image *img, const struct ImageReadOptions *opts) {
   if (!png_init_called) {
     png_init(0, 0);
     png_init_called = 1;
@@ -44,7 +235,11 @@ int read_image(const char *filename, struct Image *img) {
 
   png_t png;
 
-  if (png_open_file_read(&png, filename) != PNG_NO_ERROR) {
+  int rc = png_open_file_read(&png, filename);
+  if (rc == PNG_HEADER_ERROR) {
+    // not a PNG file, but it may be a .rgba file
+    return read_rgba_image(filename, img);
+  } else if (rc != PNG_NO_ERROR) {
     return IMG_ERR_COULD_NOT_OPEN;
   }
 
@@ -55,97 +250,166 @@ int read_image(const char *filename, struct Image *img) {
     return IMG_ERR_NOT_TRUECOLOR;
   }
 
-  unsigned num_pixels = png.width * png.height;
-
-  // allocate buffer for pixel data in truecolor RGBA format
-  uint32_t *pixel_data = (uint32_t *) malloc(num_pixels * sizeof(uint32_t));
+  uint32_t threads = opts->threads ? opts->threads : parallel_default_threads();
+  png_set_threads(&png, threads);
+  png_set_crc_check(&png, !opts->skip_crc);
 
-  if (png.color_type == PNG_TRUECOLOR) {
-    // PNG pixel data is in RGB form, expand it to add the alpha channel
-
-    unsigned char *pixel_data_raw = (unsigned char *) malloc(num_pixels * 3);
-    if (png_get_data(&png, pixel_data_raw) != PNG_NO_ERROR) {
-      png_close_file(&png);
-      free(pixel_data);
-      return IMG_ERR_MALLOC_FAILED;
-    }
-
-    for (unsigned i = 0; i < num_pixels; i++) {
-      unsigned char r = pixel_data_raw[i*3 + 0];
-      unsigned char g = pixel_data_raw[i*3 + 1];
-      unsigned char b = pixel_data_raw[i*3 + 2];
-      unsigned char a = 255;
-
-      pixel_data[i] = (r << 24) | (g << 16) | (b << 8) | a;
-    }
-
-    free(pixel_data_raw);
-  } else {
-    // PNG pixel data is already in the correct format,
-    // except that the RGBA data is in big-endian form, so we
-    // need to byteswap if on a little endian system
-    if (png_get_data(&png, (unsigned char *) pixel_data) != PNG_NO_ERROR) {
-      png_close_file(&png);
-      free(pixel_data);
-      return IMG_ERR_MALLOC_FAILED;
-    }
+  // allocate buffer for pixel data in truecolor RGBA format;
+  // rows are decoded directly into it (store_row only touches
+  // its own row, so rows can be stored on any thread)
+  struct ReadTarget target = { .width = png.width, .bpp = png.bpp };
+  target.pixel_data = (uint32_t *) malloc((size_t) png.width * png.height * sizeof(uint32_t));
+  if (target.pixel_data == NULL) {
+    png_close_file(&png);
+    return IMG_ERR_MALLOC_FAILED;
+  }
 
-    if (is_little_endian()) {
-      for (unsigned i = 0; i < num_pixels; i++) {
-        pixel_data[i] = byteswap(pixel_data[i]);
-      }
-    }
+  if (png_get_rows(&png, store_row, &target) != PNG_NO_ERROR) {
+    png_close_file(&png);
+    free(target.pixel_data);
+    return IMG_ERR_MALLOC_FAILED;
   }
 
   // communicate pixel data and image dimensions to caller
-  img->data = pixel_data;
+  img->data = target.pixel_data;
   img->width = png.width;
   img->height = png.height;
+  img->opacity = NULL;
+  img->mapping = NULL;
 
   png_close_file(&png);
 
   return IMG_SUCCESS;
 }
 
-int write_image(const char *filename, struct Image *img) {
+const struct ImageReadOptions PNG_READ_DEFAULT = { .threads = 0, .skip_crc = 0 };
+
+const struct PngWriteOptions PNG_WRITE_DEFAULT = {
+  .level = -1, .strategy = IMG_STRATEGY_DEFAULT, .filter_mode = IMG_FILTER_NONE, .idat_size = 65536,
+  .threads = 0,
+};
+
+const struct PngWriteOptions PNG_WRITE_PREVIEW = {
+  .level = 1, .strategy = IMG_STRATEGY_DEFAULT, .filter_mode = IMG_FILTER_NONE, .idat_size = 65536,
+  .threads = 0,
+};
+
+const struct PngWriteOptions PNG_WRITE_ARCHIVE = {
+  .level = 9, .strategy = IMG_STRATEGY_DEFAULT, .filter_mode = IMG_FILTER_MAX, .idat_size = 1 << 20,
+  .threads = 1,
+};
+
+//
+// Checks that every write option is in range, before any file
+// is created.
+//
+static int options_valid(const struct PngWriteOptions *opts) {
+  return opts->level >= -1 && opts->level <= 9 &&
+         opts->strategy >= IMG_STRATEGY_DEFAULT && opts->strategy <= IMG_STRATEGY_FIXED &&
+         opts->filter_mode >= IMG_FILTER_NONE && opts->filter_mode <= IMG_FILTER_MAX &&
+         opts->idat_size >= 1 && opts->idat_size <= 0x7fffffffU;
+}
+
+// state of an image being written a few rows at a time
+struct ImageWriter {
+  png_t png;
+  uint32_t width;
+  uint32_t *row;  // one row, in the byte order PNG requires
+};
+
+int begin_write_image(struct ImageWriter **writer, const char *filename, uint32_t width, uint32_t height) {
+  return begin_write_image_ex(writer, filename, width, height, &PNG_WRITE_DEFAULT);
+}
+
+int begin_write_image_ex(struct ImageWriter **writer, const char *filename, uint32_t width, uint32_t height,
+                         const struct PngWriteOptions *opts) {
+  if (!options_valid(opts)) {
+    return IMG_ERR_BAD_OPTIONS;
+  }
+
   if (!png_init_called) {
     png_init(0, 0);
     png_init_called = 1;
   }
 
-  png_t png;
+  struct ImageWriter *w = (struct ImageWriter *) malloc(sizeof(struct ImageWriter));
+  if (w == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  w->width = width;
+  w->row = (uint32_t *) malloc((size_t) width * sizeof(uint32_t) + 1);
+  if (w->row == NULL) {
+    free(w);
+    return IMG_ERR_MALLOC_FAILED;
+  }
 
-  if (png_open_file_write(&png, filename) != PNG_NO_ERROR) {
+  if (png_open_file_write(&w->png, filename) != PNG_NO_ERROR) {
+    free(w->row);
+    free(w);
     return IMG_ERR_COULD_NOT_OPEN;
   }
 
-  // if this is a little endian system, we need to byteswap
-  // every uint32_t so that it can be written in big-endian order
-  // (which is what PNG requires)
-
-  uint32_t *data_to_write = img->data;
-  int need_byteswap = is_little_endian();
+  // the IMG_STRATEGY_* and IMG_FILTER_* values are zlib's and pnglite's
+  png_set_compression(&w->png, opts->level, opts->strategy);
+  png_set_filter_mode(&w->png, opts->filter_mode);
+  png_set_idat_size(&w->png, opts->idat_size);
+  png_set_threads(&w->png, opts->threads != 0 ? opts->threads : parallel_default_threads());
+
+  if (png_write_begin(&w->png, width, height, 8, PNG_TRUECOLOR_ALPHA) != PNG_NO_ERROR) {
+    png_close_file(&w->png);
+    free(w->row);
+    free(w);
+    return IMG_ERR_COULD_NOT_WRITE;
+  }
 
-  if (need_byteswap) {
-    data_to_write = (uint32_t *) malloc(img->width * img->height * sizeof(uint32_t));
-    if (data_to_write == NULL) {
-      png_close_file(&png);
-      return IMG_ERR_MALLOC_FAILED;
-    }
+  *writer = w;
+  return IMG_SUCCESS;
+}
 
-    uint32_t num_pixels = img->width * img->height;
-    for (uint32_t i = 0; i < num_pixels; i++) {
-      data_to_write[i] = byteswap(img->data[i]);
+int write_image_rows(struct ImageWriter *writer, const uint32_t *pixels, uint32_t num_rows) {
+  for (uint32_t y = 0; y < num_rows; y++) {
+    const uint32_t *src = pixels + (size_t) y * writer->width;
+    const uint32_t *row_to_write = src;
+
+    // if this is a little endian system, we need to byteswap
+    // every uint32_t so that it can be written in big-endian order
+    // (which is what PNG requires), one row at a time
+#if IMG_LITTLE_ENDIAN
+    png_pixels_to_rgba(src, (unsigned char *) writer->row, writer->width);
+    row_to_write = writer->row;
+#endif
+
+    if (png_write_rows(&writer->png, (unsigned char *) row_to_write, 1) != PNG_NO_ERROR) {
+      return IMG_ERR_COULD_NOT_WRITE;
     }
   }
 
-  int rc = png_set_data(&png, img->width, img->height, 8, PNG_TRUECOLOR_ALPHA, (unsigned char *) data_to_write);
-  int success = (rc == PNG_NO_ERROR);
+  return IMG_SUCCESS;
+}
+
+int finish_write_image(struct ImageWriter *writer) {
+  int rc = png_write_finish(&writer->png);
+  png_close_file(&writer->png);
+  free(writer->row);
+  free(writer);
 
-  png_close_file(&png);
-  if (need_byteswap) {
-    free(data_to_write);
+  return rc == PNG_NO_ERROR ? IMG_SUCCESS : IMG_ERR_COULD_NOT_WRITE;
+}
+
+int write_image(const char *filename, struct Image *img) {
+  return write_image_ex(filename, img, &PNG_WRITE_DEFAULT);
+}
+
+int write_image_ex(const char *filename, const struct Image *img, const struct PngWriteOptions *opts) {
+  struct ImageWriter *writer;
+  int rc = begin_write_image_ex(&writer, filename, img->width, img->height, opts);
+  if (rc != IMG_SUCCESS) {
+    return rc;
   }
 
-  return success ? IMG_SUCCESS : IMG_ERR_COULD_NOT_WRITE;
+  // stream the rows, so no copy of the whole image is ever made
+  rc = write_image_rows(writer, img->data, img->height);
+  int finish_rc = finish_write_image(writer);
+
+  return rc != IMG_SUCCESS ? rc : finish_rc;
 }
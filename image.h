@@ -3,10 +3,18 @@
 
 #include <stdint.h>
 
+struct OpacityIndex;
+struct ImageMapping;
+
 struct Image {
   uint32_t width;
   uint32_t height;
   uint32_t *data;
+  // optional per-row opacity runs, see opacity.h (NULL if not built)
+  struct OpacityIndex *opacity;
+  // the .rgba file data points into, or NULL if data was allocated
+  // with malloc (see free_image)
+  struct ImageMapping *mapping;
 };
 
 // return values from init_image, read_image, and write_image
@@ -15,6 +23,52 @@ struct Image {
 #define IMG_ERR_NOT_TRUECOLOR    -2
 #define IMG_ERR_MALLOC_FAILED    -3
 #define IMG_ERR_COULD_NOT_WRITE  -4
+#define IMG_ERR_BAD_OPTIONS      -5
+
+// compression strategies (the same values as zlib's)
+#define IMG_STRATEGY_DEFAULT   0  // look for any repeated strings
+#define IMG_STRATEGY_FILTERED  1  // favor short matches (for filtered data)
+#define IMG_STRATEGY_HUFFMAN   2  // no matches at all, only Huffman coding
+#define IMG_STRATEGY_RLE       3  // only runs of one repeated byte or pixel
+#define IMG_STRATEGY_FIXED     4  // no dynamic Huffman codes
+
+// row filter modes (the same values as PNG_FILTER_MODE_* in pnglite.h)
+#define IMG_FILTER_NONE      0  // no filtering
+#define IMG_FILTER_FAST      1  // Sub or Up
+#define IMG_FILTER_BALANCED  2  // every filter, picked by a heuristic
+#define IMG_FILTER_MAX       3  // every filter, picked by trial compression
+
+// first 8 bytes of a .rgba file (like PNG's, a binary byte and
+// line endings that a text mode transfer would break)
+#define RGBA_MAGIC "\x89RGBA\r\n\x1a"
+
+// How write_image_ex compresses an image.
+struct PngWriteOptions {
+  int level;           // 0 (no compression) to 9 (smallest), or -1 for zlib's default
+  int strategy;        // one of the IMG_STRATEGY_* values
+  int filter_mode;     // one of the IMG_FILTER_* values
+  uint32_t idat_size;  // most compressed bytes per IDAT chunk
+  uint32_t threads;    // threads to compress with, 0 for one per core
+};
+
+// the options write_image uses
+extern const struct PngWriteOptions PNG_WRITE_DEFAULT;
+// fastest output, for previews (level 1; IMG_STRATEGY_RLE only
+// finds runs of one repeated byte, which RGBA pixels aren't, so
+// it is slower and much bigger here)
+extern const struct PngWriteOptions PNG_WRITE_PREVIEW;
+// smallest output, for archival, at many times the encode time
+// (and on one thread, since threads cost a little compression)
+extern const struct PngWriteOptions PNG_WRITE_ARCHIVE;
+
+// How read_image_ex decodes an image.
+struct ImageReadOptions {
+  uint32_t threads;  // threads to unfilter and convert rows with, 0 for one per core
+  int skip_crc;      // don't check chunk CRCs (only for trusted files, like a local cache)
+};
+
+// the options read_image uses
+extern const struct ImageReadOptions PNG_READ_DEFAULT;
 
 // Initialize an Image struct instance by creating a pixel
 // buffer large enough to accommodate an image of the specified
@@ -34,7 +88,10 @@ struct Image {
 int init_image(struct Image *img, uint32_t width, uint32_t height);
 
 // Read PNG image data from a file and initialize the specified
-// Image struct instance.
+// Image struct instance. The file may also be a .rgba file (see
+// write_rgba_image); its pixels are then mapped rather than read,
+// and if its rows aren't padded, data points straight into the
+// mapping. Either way, free the pixels with free_image.
 //
 // Parameters:
 //   filename - name of PNG file to read
@@ -46,6 +103,48 @@ int init_image(struct Image *img, uint32_t width, uint32_t height);
 //   IMG_ERR_* values
 int read_image(const char *filename, struct Image *img);
 
+// Read PNG image data from a file, choosing how it is decoded.
+// Inflating is always serial; with more than one thread, rows are
+// unfiltered and converted to RGBA on several threads, a batch at
+// a time. Otherwise the same as read_image.
+//
+// Parameters:
+//   filename - name of PNG file to read
+//   img - pointer to Image struct to initialize with the loaded
+//         image data
+//   opts - pointer to the decoding options
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int read_image_ex(const char *filename, struct Image *img, const struct ImageReadOptions *opts);
+
+// Free the pixels of an image, whether they were allocated or are
+// a mapped .rgba file, and clear data (the opacity index is freed
+// separately, see detach_opacity_index).
+//
+// Parameters:
+//   img - pointer to the image
+void free_image(struct Image *img);
+
+// Write pixel data to a .rgba file: a 64 byte header (see
+// RGBA_MAGIC) followed by the rows, each padded to a multiple of
+// 64 bytes, as 32 bit pixels in this system's byte order.
+// read_image loads such a file without decoding anything; its
+// pixels are mapped copy-on-write, so an image read from it can
+// still be drawn onto without changing the file. When the width
+// is a multiple of 16 the rows need no padding and read_image
+// doesn't even copy them.
+//
+// Parameters:
+//   filename - name of .rgba file to write
+//   img - pointer to Image struct with the pixel data to write
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int write_rgba_image(const char *filename, const struct Image *img);
+
 // Write pixel data from specified Image struct instance to the
 // named PNG output file.
 //
@@ -59,4 +158,75 @@ int read_image(const char *filename, struct Image *img);
 //   IMG_ERR_* values
 int write_image(const char *filename, struct Image *img);
 
+// Write pixel data to a PNG file, choosing how it is compressed.
+//
+// Parameters:
+//   filename - name of PNG file to write
+//   img - pointer to Image struct with the pixel data to write
+//   opts - pointer to the compression options
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_BAD_OPTIONS if an option
+//   is out of range, otherwise one of the IMG_ERR_* values
+int write_image_ex(const char *filename, const struct Image *img, const struct PngWriteOptions *opts);
+
+// An image being written to a PNG file a few rows at a time,
+// so that rows can be written as soon as they are rendered
+// and the whole image never has to be in memory.
+struct ImageWriter;
+
+// Create a PNG file and start writing an image to it.
+// If this succeeds, finish_write_image must be called
+// (even if writing the rows fails).
+//
+// Parameters:
+//   writer - pointer to where the new ImageWriter is stored
+//   filename - name of PNG file to write
+//   width - image width (number of pixel columns)
+//   height - image height (number of pixel rows)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int begin_write_image(struct ImageWriter **writer, const char *filename, uint32_t width, uint32_t height);
+
+// Create a PNG file and start writing an image to it, choosing
+// how it is compressed. Otherwise the same as begin_write_image.
+//
+// Parameters:
+//   writer - pointer to where the new ImageWriter is stored
+//   filename - name of PNG file to write
+//   width - image width (number of pixel columns)
+//   height - image height (number of pixel rows)
+//   opts - pointer to the compression options
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_BAD_OPTIONS if an option
+//   is out of range, otherwise one of the IMG_ERR_* values
+int begin_write_image_ex(struct ImageWriter **writer, const char *filename, uint32_t width, uint32_t height,
+                         const struct PngWriteOptions *opts);
+
+// Write the next rows of the image, top to bottom.
+//
+// Parameters:
+//   writer - pointer to ImageWriter
+//   pixels - the rows' pixel data, width pixels per row
+//   num_rows - number of rows to write
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int write_image_rows(struct ImageWriter *writer, const uint32_t *pixels, uint32_t num_rows);
+
+// Finish writing the image and free the ImageWriter.
+// Fails if fewer rows than the image height were written.
+//
+// Parameters:
+//   writer - pointer to ImageWriter
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int finish_write_image(struct ImageWriter *writer);
+
 #endif
@@ -0,0 +1,263 @@
+/*
+ * Cache of decoded images
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "image_cache.h"
+#include "opacity.h"
+
+// identifies one version of a file
+struct FileStamp {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+};
+
+// one decoded image
+struct CacheEntry {
+  char *filename;
+  struct FileStamp stamp;
+  struct Image img;      // pixels and opacity index, shared by every load
+  size_t bytes;
+  uint32_t refs;         // loads not released yet
+  struct CacheEntry *prev, *next;  // most recently used first
+};
+
+struct ImageCache {
+  pthread_mutex_t lock;
+  size_t max_bytes;
+  struct CacheEntry *head, *tail;
+  struct ImageCacheStats stats;
+};
+
+//
+// Gets the stamp of a file, returning 0 if it can't be found.
+//
+static int file_stamp(const char *filename, struct FileStamp *stamp) {
+  struct stat st;
+  if (stat(filename, &st) != 0) {
+    return 0;
+  }
+  memset(stamp, 0, sizeof(*stamp));
+  stamp->dev = st.st_dev;
+  stamp->ino = st.st_ino;
+  stamp->size = st.st_size;
+  stamp->mtime = st.st_mtim;
+  return 1;
+}
+
+static int same_stamp(const struct FileStamp *a, const struct FileStamp *b) {
+  return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+         a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+//
+// Unlinks an entry from the recency list.
+//
+static void unlink_entry(struct ImageCache *cache, struct CacheEntry *e) {
+  if (e->prev != NULL) {
+    e->prev->next = e->next;
+  } else {
+    cache->head = e->next;
+  }
+  if (e->next != NULL) {
+    e->next->prev = e->prev;
+  } else {
+    cache->tail = e->prev;
+  }
+  e->prev = e->next = NULL;
+}
+
+//
+// Makes an entry the most recently used one.
+//
+static void push_front(struct ImageCache *cache, struct CacheEntry *e) {
+  e->prev = NULL;
+  e->next = cache->head;
+  if (cache->head != NULL) {
+    cache->head->prev = e;
+  } else {
+    cache->tail = e;
+  }
+  cache->head = e;
+}
+
+static void free_entry(struct CacheEntry *e) {
+  detach_opacity_index(&e->img);
+  free_image(&e->img);
+  free(e->filename);
+  free(e);
+}
+
+//
+// Drops an unused entry from the cache.
+//
+static void drop_entry(struct ImageCache *cache, struct CacheEntry *e) {
+  unlink_entry(cache, e);
+  cache->stats.bytes -= e->bytes;
+  cache->stats.images--;
+  free_entry(e);
+}
+
+//
+// Drops the least recently used entries that aren't in use until
+// the cache is under its limit (or nothing more can go).
+//
+static void trim(struct ImageCache *cache) {
+  struct CacheEntry *e = cache->tail;
+  while (e != NULL && cache->stats.bytes > cache->max_bytes) {
+    struct CacheEntry *prev = e->prev;
+    if (e->refs == 0) {
+      drop_entry(cache, e);
+      cache->stats.evictions++;
+    }
+    e = prev;
+  }
+}
+
+//
+// Finds the entry for a file, dropping unused entries for older
+// versions of it. The cache must be locked.
+//
+static struct CacheEntry *find_entry(struct ImageCache *cache, const char *filename,
+                                     const struct FileStamp *stamp) {
+  struct CacheEntry *found = NULL;
+  struct CacheEntry *e = cache->head;
+  while (e != NULL) {
+    struct CacheEntry *next = e->next;
+    if (strcmp(e->filename, filename) == 0) {
+      if (same_stamp(&e->stamp, stamp)) {
+        found = e;
+      } else if (e->refs == 0) {
+        drop_entry(cache, e);
+      }
+    }
+    e = next;
+  }
+  return found;
+}
+
+//
+// Hands out a reference to an entry. The cache must be locked.
+//
+static void use_entry(struct ImageCache *cache, struct CacheEntry *e, struct Image *img) {
+  e->refs++;
+  unlink_entry(cache, e);
+  push_front(cache, e);
+  *img = e->img;
+}
+
+int image_cache_create(struct ImageCache **cache, size_t max_bytes) {
+  struct ImageCache *c = (struct ImageCache *) calloc(1, sizeof(struct ImageCache));
+  if (c == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  pthread_mutex_init(&c->lock, NULL);
+  c->max_bytes = max_bytes;
+  *cache = c;
+  return IMG_SUCCESS;
+}
+
+void image_cache_destroy(struct ImageCache *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  struct CacheEntry *e = cache->head;
+  while (e != NULL) {
+    struct CacheEntry *next = e->next;
+    free_entry(e);
+    e = next;
+  }
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+int image_cache_load(struct ImageCache *cache, const char *filename, struct Image *img) {
+  struct FileStamp stamp;
+  if (!file_stamp(filename, &stamp)) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  struct CacheEntry *e = find_entry(cache, filename, &stamp);
+  if (e != NULL) {
+    cache->stats.hits++;
+    use_entry(cache, e, img);
+    pthread_mutex_unlock(&cache->lock);
+    return IMG_SUCCESS;
+  }
+  cache->stats.misses++;
+  pthread_mutex_unlock(&cache->lock);
+
+  // decode without holding the lock, so other images can be
+  // loaded at the same time
+  e = (struct CacheEntry *) calloc(1, sizeof(struct CacheEntry));
+  if (e == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  e->filename = strdup(filename);
+  e->stamp = stamp;
+  int rc = e->filename != NULL ? read_image(filename, &e->img) : IMG_ERR_MALLOC_FAILED;
+  if (rc == IMG_SUCCESS) {
+    rc = attach_opacity_index(&e->img);
+  }
+  if (rc != IMG_SUCCESS) {
+    free_entry(e);
+    return rc;
+  }
+  e->bytes = (size_t) e->img.width * e->img.height * sizeof(uint32_t) +
+             (e->img.height + 1) * sizeof(uint32_t) +
+             e->img.opacity->row_start[e->img.height] * sizeof(struct OpacityRun);
+
+  pthread_mutex_lock(&cache->lock);
+  struct CacheEntry *other = find_entry(cache, filename, &stamp);
+  if (other != NULL) {
+    // another thread decoded it first
+    free_entry(e);
+    e = other;
+  } else {
+    push_front(cache, e);
+    cache->stats.bytes += e->bytes;
+    cache->stats.images++;
+  }
+  use_entry(cache, e, img);
+  trim(cache);
+  pthread_mutex_unlock(&cache->lock);
+  return IMG_SUCCESS;
+}
+
+void image_cache_release(struct ImageCache *cache, struct Image *img) {
+  if (img->data == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  for (struct CacheEntry *e = cache->head; e != NULL; e = e->next) {
+    if (e->img.data == img->data) {
+      e->refs--;
+      break;
+    }
+  }
+  trim(cache);
+  pthread_mutex_unlock(&cache->lock);
+
+  img->data = NULL;
+  img->opacity = NULL;
+  img->mapping = NULL;
+  img->width = img->height = 0;
+}
+
+void image_cache_stats(struct ImageCache *cache, struct ImageCacheStats *stats) {
+  pthread_mutex_lock(&cache->lock);
+  *stats = cache->stats;
+  pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,87 @@
+/*
+ * Cache of decoded images
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "image.h"
+
+// Decoded images, shared by everything that loads the same file.
+// An image is looked up by its path, modification time, and size,
+// so a file that changed is decoded again. Cached images get an
+// opacity index (see opacity.h) and are only ever drawn from:
+// since every load of a file shares one pixel buffer, they must
+// never be drawn onto. The cache is safe to use from several
+// threads at once.
+struct ImageCache;
+
+// counters of an ImageCache
+struct ImageCacheStats {
+  uint64_t hits;        // loads that found the image already decoded
+  uint64_t misses;      // loads that read the file
+  uint64_t evictions;   // images dropped to stay under the size limit
+  size_t bytes;         // pixel and index bytes of the images held now
+  uint32_t images;      // number of images held now
+};
+
+// Create an empty cache.
+//
+// Parameters:
+//   cache - pointer to where the new ImageCache is stored
+//   max_bytes - how many bytes of decoded images to keep once
+//               they are no longer used; the least recently
+//               used ones are dropped first (images in use are
+//               never dropped, even if they are over the limit)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+int image_cache_create(struct ImageCache **cache, size_t max_bytes);
+
+// Free a cache and every image in it. Images still in use must
+// not be drawn from afterwards.
+//
+// Parameters:
+//   cache - pointer to the ImageCache (may be NULL)
+void image_cache_destroy(struct ImageCache *cache);
+
+// Load a PNG file through the cache. If the file has been loaded
+// before (and hasn't changed since), img shares the decoded
+// pixels; otherwise it is read with read_image and indexed.
+// Either way, the image must be given back with
+// image_cache_release, and not with free or detach_opacity_index.
+//
+// Parameters:
+//   cache - pointer to the ImageCache
+//   filename - name of PNG file to load
+//   img - pointer to Image struct to initialize with the shared
+//         image data
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int image_cache_load(struct ImageCache *cache, const char *filename, struct Image *img);
+
+// Give back an image loaded with image_cache_load. It stays in
+// the cache for later loads until the size limit pushes it out.
+// img is cleared (does nothing if img has no data).
+//
+// Parameters:
+//   cache - pointer to the ImageCache
+//   img - pointer to the image to give back
+void image_cache_release(struct ImageCache *cache, struct Image *img);
+
+// Get the counters of a cache.
+//
+// Parameters:
+//   cache - pointer to the ImageCache
+//   stats - pointer to ImageCacheStats to fill in
+void image_cache_stats(struct ImageCache *cache, struct ImageCacheStats *stats);
+
+#endif // IMAGE_CACHE_H
@@ -0,0 +1,120 @@
+/*
+ * Per-row opacity run index for sprite sheets
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+#include <stdlib.h>
+#include "opacity.h"
+
+//
+// Classifies a pixel by its alpha value.
+//
+static uint32_t opacity_kind(uint32_t color) {
+  uint32_t alpha = color & 0xFF;
+  if (alpha == 0x00) {
+    return OPACITY_TRANSPARENT;
+  } else if (alpha == 0xFF) {
+    return OPACITY_OPAQUE;
+  } else {
+    return OPACITY_PARTIAL;
+  }
+}
+
+int build_opacity_index(struct OpacityIndex *index, const struct Image *img) {
+  uint32_t capacity = img->height + 16;
+  uint32_t num_runs = 0;
+
+  index->height = img->height;
+  index->row_start = (uint32_t *) malloc((img->height + 1) * sizeof(uint32_t));
+  index->runs = (struct OpacityRun *) malloc(capacity * sizeof(struct OpacityRun));
+  if (index->row_start == NULL || index->runs == NULL) {
+    free_opacity_index(index);
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  for (uint32_t y = 0; y < img->height; y++) {
+    const uint32_t *row = img->data + y * img->width;
+    index->row_start[y] = num_runs;
+
+    uint32_t x = 0;
+    while (x < img->width) {
+      // extend the run as far as the opacity stays the same
+      uint32_t kind = opacity_kind(row[x]);
+      uint32_t end = x + 1;
+      while (end < img->width && opacity_kind(row[end]) == kind) {
+        end++;
+      }
+
+      if (num_runs == capacity) {
+        capacity *= 2;
+        struct OpacityRun *grown = (struct OpacityRun *) realloc(index->runs, capacity * sizeof(struct OpacityRun));
+        if (grown == NULL) {
+          free_opacity_index(index);
+          return IMG_ERR_MALLOC_FAILED;
+        }
+        index->runs = grown;
+      }
+
+      index->runs[num_runs].x = x;
+      index->runs[num_runs].length = end - x;
+      index->runs[num_runs].kind = kind;
+      num_runs++;
+      x = end;
+    }
+  }
+  index->row_start[img->height] = num_runs;
+
+  return IMG_SUCCESS;
+}
+
+void free_opacity_index(struct OpacityIndex *index) {
+  free(index->row_start);
+  free(index->runs);
+  index->row_start = NULL;
+  index->runs = NULL;
+  index->height = 0;
+}
+
+uint32_t find_opacity_run(const struct OpacityIndex *index, uint32_t y, uint32_t x) {
+  uint32_t lo = index->row_start[y];
+  uint32_t hi = index->row_start[y + 1] - 1;
+
+  // binary search for the last run starting at or before x
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo + 1) / 2;
+    if (index->runs[mid].x <= x) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+int attach_opacity_index(struct Image *img) {
+  struct OpacityIndex *index = (struct OpacityIndex *) malloc(sizeof(struct OpacityIndex));
+  if (index == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  if (build_opacity_index(index, img) != IMG_SUCCESS) {
+    free(index);
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  detach_opacity_index(img);
+  img->opacity = index;
+  return IMG_SUCCESS;
+}
+
+void detach_opacity_index(struct Image *img) {
+  if (img->opacity != NULL) {
+    free_opacity_index(img->opacity);
+    free(img->opacity);
+    img->opacity = NULL;
+  }
+}
@@ -0,0 +1,82 @@
+/*
+ * Per-row opacity run index for sprite sheets
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef OPACITY_H
+#define OPACITY_H
+
+#include <stdint.h>
+#include "image.h"
+
+// kinds of opacity runs
+#define OPACITY_TRANSPARENT  0  // every pixel has alpha 0x00
+#define OPACITY_OPAQUE       1  // every pixel has alpha 0xFF
+#define OPACITY_PARTIAL      2  // every pixel needs blending
+
+// A run of pixels in one row that all have the same kind of opacity.
+struct OpacityRun {
+  uint32_t x;
+  uint32_t length;
+  uint32_t kind;
+};
+
+// Runs for every row of an image. The runs of row y are
+// runs[row_start[y]] up to (not including) runs[row_start[y + 1]],
+// ordered left to right, and together they cover the whole row.
+struct OpacityIndex {
+  uint32_t height;
+  uint32_t *row_start;
+  struct OpacityRun *runs;
+};
+
+// Build the opacity index of an image.
+//
+// Parameters:
+//   index - pointer to OpacityIndex to initialize
+//   img - pointer to the image to index
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+int build_opacity_index(struct OpacityIndex *index, const struct Image *img);
+
+// Free the memory owned by an opacity index.
+//
+// Parameters:
+//   index - pointer to OpacityIndex to free
+void free_opacity_index(struct OpacityIndex *index);
+
+// Find the run of a row that contains a given column.
+//
+// Parameters:
+//   index - pointer to OpacityIndex
+//   y - row of the image
+//   x - column of the image (must be within the image)
+//
+// Returns:
+//   index into index->runs of the run containing column x
+uint32_t find_opacity_run(const struct OpacityIndex *index, uint32_t y, uint32_t x);
+
+// Build the opacity index of an image and attach it to the image,
+// so that draw_sprite can skip transparent runs, copy opaque runs,
+// and only blend the partially transparent pixels. This is only
+// worth doing for sprite sheets; the image must not be drawn onto
+// afterwards, since that would make the index stale.
+//
+// Parameters:
+//   img - pointer to the image to index
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+int attach_opacity_index(struct Image *img);
+
+// Free the opacity index attached to an image, if any.
+//
+// Parameters:
+//   img - pointer to the image
+void detach_opacity_index(struct Image *img);
+
+#endif // OPACITY_H
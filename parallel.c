@@ -0,0 +1,70 @@
+/*
+ * Minimal thread pool helpers
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "parallel.h"
+
+// state shared by all threads of one parallel_for
+struct ParallelJob {
+  uint32_t count;
+  uint32_t next;  // next unclaimed index, claimed atomically
+  ParallelFn fn;
+  void *arg;
+};
+
+//
+// Claims and runs work items until there are none left.
+//
+static void *parallel_worker(void *p) {
+  struct ParallelJob *job = (struct ParallelJob *) p;
+  for (;;) {
+    uint32_t index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+    if (index >= job->count) {
+      break;
+    }
+    job->fn(job->arg, index);
+  }
+  return NULL;
+}
+
+void parallel_for(uint32_t count, uint32_t num_threads, ParallelFn fn, void *arg) {
+  struct ParallelJob job = { .count = count, .next = 0, .fn = fn, .arg = arg };
+
+  if (num_threads > count) {
+    num_threads = count;
+  }
+  if (num_threads <= 1) {
+    parallel_worker(&job);
+    return;
+  }
+
+  // the calling thread is one of the workers
+  pthread_t *threads = (pthread_t *) malloc((num_threads - 1) * sizeof(pthread_t));
+  uint32_t started = 0;
+  if (threads != NULL) {
+    while (started < num_threads - 1 &&
+           pthread_create(&threads[started], NULL, parallel_worker, &job) == 0) {
+      started++;
+    }
+  }
+
+  parallel_worker(&job);
+
+  for (uint32_t i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+}
+
+uint32_t parallel_default_threads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (uint32_t) n : 1;
+}
@@ -0,0 +1,43 @@
+/*
+ * Minimal thread pool helpers
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+
+// Work function called once for every index of a parallel_for.
+//
+// Parameters:
+//   arg   - the arg pointer passed to parallel_for
+//   index - index of the work item, 0 <= index < count
+typedef void (*ParallelFn)(void *arg, uint32_t index);
+
+// Call fn(arg, i) for every i in [0, count), spreading the calls
+// over up to num_threads threads (including the calling thread).
+// Work items are handed out one at a time, so items may take
+// different amounts of time. Returns once every call has finished.
+// If threads can't be created, the remaining work simply runs on
+// the threads that were.
+//
+// Parameters:
+//   count       - number of work items
+//   num_threads - maximum number of threads to use (0 or 1 means
+//                 run everything on the calling thread)
+//   fn          - work function
+//   arg         - passed through to fn
+void parallel_for(uint32_t count, uint32_t num_threads, ParallelFn fn, void *arg);
+
+// Number of threads to use when the user didn't ask for a number:
+// one per online CPU.
+//
+// Returns:
+//   number of online CPUs (at least 1)
+uint32_t parallel_default_threads(void);
+
+#endif // PARALLEL_H
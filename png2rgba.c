@@ -0,0 +1,38 @@
+/*
+ * Converter from PNG to the pre-decoded .rgba format
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+// Decodes a PNG file once and writes its pixels as a .rgba file
+// (see write_rgba_image), which read_image (and so the L command
+// of c_draw) loads by mapping it instead of decoding. Sprite
+// sheets whose width is a multiple of 16 aren't even copied.
+
+#include <stdio.h>
+#include "image.h"
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s input.png output.rgba\n", argv[0]);
+    return 1;
+  }
+
+  struct Image img;
+  if (read_image(argv[1], &img) != IMG_SUCCESS) {
+    fprintf(stderr, "Error: could not read %s\n", argv[1]);
+    return 1;
+  }
+
+  int rc = write_rgba_image(argv[2], &img);
+  free_image(&img);
+  if (rc != IMG_SUCCESS) {
+    fprintf(stderr, "Error: could not write %s\n", argv[2]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -13,7 +13,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define USE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define USE_MMAP 0
+#endif
+
 #include "pnglite.h"
+#include "pnglite_simd.h"
+#include "pnglite_crc.h"
+#include "parallel.h"
+
+/* largest IDAT chunk written, and so the size of the compression output buffer */
+#define PNG_IDAT_SIZE 65536
+
+/* filtered bytes compressed by one thread at a time when writing with several threads */
+#define PNG_SEGMENT_SIZE 262144
+
+/* one thread's share of the rows being compressed in parallel */
+typedef struct
+{
+	z_stream			zs;			/* raw deflate, reset for every segment */
+	unsigned char*			filterbuf;		/* as png->filterbuf */
+	unsigned char*			dictbuf;		/* filtered rows before the segment */
+	unsigned char*			out;
+	unsigned			outcap;
+	unsigned			outlen;
+	unsigned long			adler;			/* adler32 of the segment's filtered bytes */
+	unsigned			first_row;		/* index of the segment's first row in png->segbuf */
+	unsigned			num_rows;
+	unsigned			dict_rows;		/* rows before it used as the dictionary */
+	int				last;			/* the segment ends the image */
+	int				result;
+} png_segment_t;
 
 static png_alloc_t png_alloc;
 static png_free_t png_free;
@@ -21,7 +58,18 @@ static png_free_t png_free;
 static size_t file_read(png_t* png, void* out, size_t size, size_t numel)
 {
 	size_t result;
-	if(png->read_fun)
+	if(png->mem)
+	{
+		/* whole elements only, as fread */
+		result = (png->memlen - png->mempos) / size;
+		if(result > numel)
+			result = numel;
+
+		if(out)
+			memcpy(out, png->mem + png->mempos, result * size);
+		png->mempos += result * size;
+	}
+	else if(png->read_fun)
 	{
 		result = png->read_fun(out, size, numel, png->user_pointer);
 	}
@@ -167,8 +215,7 @@ static int png_read_ihdr(png_t* png)
 #if DO_CRC_CHECKS
 	file_read_ul(png, &orig_crc);
 
-	calc_crc = crc32(0L, 0, 0);
-	calc_crc = crc32(calc_crc, ihdr, 13+4);
+	calc_crc = png_crc32(0, ihdr, 13+4);
 
 	if(orig_crc != calc_crc)
 		return PNG_CRC_ERROR;
@@ -202,7 +249,8 @@ static int png_write_ihdr(png_t* png)
 	unsigned char *p = ihdr;
 	unsigned crc;
 
-	file_write(png, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 1, 8);
+	if(file_write(png, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 1, 8) != 8)
+		return PNG_FILE_ERROR;
 
 	file_write_ul(png, 13);
 
@@ -218,14 +266,12 @@ static int png_write_ihdr(png_t* png)
 	*p = 0;				p++;
 	*p = 0;				p++;
 
-	file_write(png, ihdr, 1, 13+4);
-
-	crc = crc32(0L, 0, 0);
-	crc = crc32(crc, ihdr, 13+4);
+	if(file_write(png, ihdr, 1, 13+4) != 13+4)
+		return PNG_FILE_ERROR;
 
-	file_write_ul(png, crc);
+	crc = png_crc32(0, ihdr, 13+4);
 
-	return PNG_NO_ERROR;
+	return file_write_ul(png, crc);
 }
 
 void png_print_info(png_t* png)
@@ -251,17 +297,13 @@ void png_print_info(png_t* png)
 	printf("\tinterlace:\t%s\n",	png->interlace_method?"interlace":"no interlace");
 }
 
-int png_open_read(png_t* png, png_read_callback_t read_fun, void* user_pointer)
+static int png_read_header(png_t* png)
 {
 	char header[8];
 	int result;
 
-	png->read_fun = read_fun;
-	png->write_fun = 0;
-	png->user_pointer = user_pointer;
-
-	if(!read_fun && !user_pointer)
-		return PNG_WRONG_ARGUMENTS;
+	png->threads = 1;
+	png->verify_crc = 1;
 
 	if(file_read(png, header, 1, 8) != 8)
 		return PNG_EOF_ERROR;
@@ -276,11 +318,48 @@ int png_open_read(png_t* png, png_read_callback_t read_fun, void* user_pointer)
 	return result;
 }
 
+int png_open_read(png_t* png, png_read_callback_t read_fun, void* user_pointer)
+{
+	png->read_fun = read_fun;
+	png->write_fun = 0;
+	png->user_pointer = user_pointer;
+	png->mem = 0;
+	png->mem_mapped = 0;
+
+	if(!read_fun && !user_pointer)
+		return PNG_WRONG_ARGUMENTS;
+
+	return png_read_header(png);
+}
+
+int png_open_mem_read(png_t* png, const void* data, size_t len)
+{
+	png->read_fun = 0;
+	png->write_fun = 0;
+	png->user_pointer = 0;
+	png->mem = data;
+	png->memlen = len;
+	png->mempos = 0;
+	png->mem_mapped = 0;
+
+	if(!data)
+		return PNG_WRONG_ARGUMENTS;
+
+	return png_read_header(png);
+}
+
 int png_open_write(png_t* png, png_write_callback_t write_fun, void* user_pointer)
 {
 	png->write_fun = write_fun;
 	png->read_fun = 0;
 	png->user_pointer = user_pointer;
+	png->mem = 0;
+	png->mem_mapped = 0;
+	png->filter_mode = PNG_FILTER_MODE_NONE;
+	png->compression_level = Z_DEFAULT_COMPRESSION;
+	png->compression_strategy = Z_DEFAULT_STRATEGY;
+	png->idat_size = PNG_IDAT_SIZE;
+	png->threads = 1;
 
 	if(!write_fun && !user_pointer)
 		return PNG_WRONG_ARGUMENTS;
@@ -295,7 +374,37 @@ int png_open(png_t* png, png_read_callback_t read_fun, void* user_pointer)
 
 int png_open_file_read(png_t *png, const char* filename)
 {
-	FILE* fp = fopen(filename, "rb");
+	FILE* fp;
+
+#if USE_MMAP
+	/* map the file if it is a regular one, so that IDATs are inflated straight from the page cache */
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+
+	if(fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		void* map = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if(map != MAP_FAILED)
+		{
+			int result;
+
+			close(fd);
+			madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+			result = png_open_mem_read(png, map, (size_t)st.st_size);
+			png->mem_mapped = 1;
+			if(result != PNG_NO_ERROR)
+				png_close_file(png);
+
+			return result;
+		}
+	}
+	if(fd >= 0)
+		close(fd);
+#endif
+
+	fp = fopen(filename, "rb");
 
 	if(!fp)
 		return PNG_FILE_ERROR;
@@ -320,6 +429,16 @@ int png_open_file(png_t *png, const char* filename)
 
 int png_close_file(png_t* png)
 {
+#if USE_MMAP
+	if(png->mem_mapped)
+	{
+		munmap((void*)png->mem, png->memlen);
+		png->mem = 0;
+		png->mem_mapped = 0;
+		return PNG_NO_ERROR;
+	}
+#endif
+
 	fclose(png->user_pointer);
 
 	return PNG_NO_ERROR;
@@ -337,7 +456,7 @@ static int png_init_deflate(png_t* png, unsigned char* data, int datalen)
 
 	memset(stream, 0, sizeof(z_stream));
 
-	if(deflateInit(stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+	if(deflateInit2(stream, png->compression_level, Z_DEFLATED, 15, 8, png->compression_strategy) != Z_OK)
 		return PNG_ZLIB_ERROR;
 
 	stream->next_in = data;
@@ -371,7 +490,8 @@ static int png_init_inflate(png_t* png)
 		return PNG_ZLIB_ERROR;
 #endif
 
-	stream->next_out = png->png_data;
+	/* png_get_rows keeps the row before the rows being inflated in front of them */
+	stream->next_out = png->png_data + (png->row_fun ? png->width * png->bpp + 1 : 0);
 	stream->avail_out = png->png_datalen;
 
 	return PNG_NO_ERROR;
@@ -450,7 +570,7 @@ static int png_inflate(png_t* png, unsigned char* data, int len)
 	return PNG_NO_ERROR;
 }
 
-static int png_deflate(png_t* png, char* outdata, int outlen, int *outwritten)
+static int png_deflate(png_t* png, char* outdata, int outlen, int *outwritten, int flush)
 {
 	int result;
 
@@ -462,7 +582,7 @@ static int png_deflate(png_t* png, char* outdata, int outlen, int *outwritten)
 	stream->next_out = (unsigned char*)outdata;
 	stream->avail_out = outlen;
 
-	result = deflate(stream, Z_SYNC_FLUSH);
+	result = deflate(stream, flush);
 
 	*outwritten = outlen - stream->avail_out;
 
@@ -475,54 +595,272 @@ static int png_deflate(png_t* png, char* outdata, int outlen, int *outwritten)
 	return result;
 }
 
-static int png_write_idats(png_t* png, unsigned char* data)
+static int png_write_chunk(png_t* png, unsigned char* chunk, unsigned length)
+{
+	/* chunk holds the 4 byte chunk type followed by length bytes of data */
+	unsigned crc;
+
+	if(file_write_ul(png, length) != PNG_NO_ERROR)
+		return PNG_FILE_ERROR;
+
+	if(file_write(png, chunk, 1, length+4) != length+4)
+		return PNG_FILE_ERROR;
+
+	crc = png_crc32(0, chunk, length+4);
+
+	return file_write_ul(png, crc);
+}
+
+static int png_flush_idat(png_t* png)
+{
+	int result;
+
+	if(png->idatlen == 0)
+		return PNG_NO_ERROR;
+
+	result = png_write_chunk(png, png->idatbuf, png->idatlen);
+	png->idatlen = 0;
+
+	return result;
+}
+
+static int png_write_deflate(png_t* png, int flush)
+{
+	/* compress the pending input, writing an IDAT every time the buffer fills up */
+	z_stream *stream = png->zs;
+	int written;
+	int result;
+
+	do
+	{
+		result = png_deflate(png, (char*)png->idatbuf + 4 + png->idatlen, png->idat_size - png->idatlen, &written, flush);
+
+		if(result < 0)
+			return result;
+
+		png->idatlen += written;
+
+		if(png->idatlen == png->idat_size && png_flush_idat(png) != PNG_NO_ERROR)
+			return PNG_FILE_ERROR;
+	}
+	while(stream->avail_in != 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+
+	return PNG_NO_ERROR;
+}
+
+static void png_free_segments(png_t* png);
+
+static void png_write_cleanup(png_t* png)
+{
+	if(png->zs)
+	{
+		png_end_deflate(png);
+		png->zs = 0;
+	}
+
+	png_free_segments(png);
+
+	png_free(png->idatbuf);
+	png->idatbuf = 0;
+	png->idatlen = 0;
+
+	png_free(png->filterbuf);
+	png->filterbuf = 0;
+}
+
+static int png_unfilter_line(png_t* png, unsigned char* line, unsigned char* prev_line)
+{
+	/* line is a filter type byte followed by the filtered row, which is unfiltered in place */
+	int len = png->width * png->bpp;
+	unsigned char* row = line + 1;
+
+	if(line[0] > PNG_FILTER_PAETH)
+		return PNG_UNKNOWN_FILTER;
+
+	if(line[0] != PNG_FILTER_NONE)
+		png_unfilter_row(line[0], png->bpp, row, prev_line, row, len);
+
+	return PNG_NO_ERROR;
+}
+
+/* rows of one batch being unfiltered and passed on by several threads */
+typedef struct
+{
+	png_t*				png;
+	unsigned char*			lines;			/* first line of the batch, as inflated */
+	unsigned			num_rows;
+	unsigned			group;			/* rows per call of png_pass_rows */
+	int				result;
+} png_rows_job_t;
+
+static void png_unfilter_chain(void* arg, uint32_t index)
+{
+	/* a chain is a None or Sub row and the rows after it that depend on the row above */
+	png_rows_job_t* job = arg;
+	png_t* png = job->png;
+	unsigned linelen = png->width * png->bpp + 1;
+	unsigned i;
+
+	for(i = png->row_chains[index]; i < png->row_chains[index + 1]; i++)
+	{
+		unsigned char* line = job->lines + (size_t)i * linelen;
+		unsigned char* prev_line = line - linelen + 1;
+
+		if(png->rows_read + i == 0)
+			prev_line = 0;
+
+		png_unfilter_line(png, line, prev_line);
+	}
+}
+
+static void png_pass_rows(void* arg, uint32_t index)
+{
+	png_rows_job_t* job = arg;
+	png_t* png = job->png;
+	unsigned linelen = png->width * png->bpp + 1;
+	unsigned i = index * job->group;
+	unsigned end = i + job->group < job->num_rows ? i + job->group : job->num_rows;
+
+	for(; i < end; i++)
+	{
+		int result = png->row_fun(job->lines + (size_t)i * linelen + 1, png->rows_read + i, png->row_user_pointer);
+
+		if(result != PNG_NO_ERROR)
+			__atomic_store_n(&job->result, result, __ATOMIC_RELAXED);
+	}
+}
+
+static int png_process_rows(png_t* png, unsigned num_rows)
 {
-	unsigned char *chunk;
-	unsigned long written;
-	unsigned long crc;
-	unsigned size = png->width * png->height * png->bpp + png->height;
-	unsigned chunk_size = compressBound(size);
+	/* png_data holds the row before the batch, then num_rows inflated lines (filter type byte and row) */
+	unsigned linelen = png->width * png->bpp + 1;
+	png_rows_job_t job;
+	unsigned num_chains = 0;
+	unsigned i;
+
+	job.png = png;
+	job.lines = png->png_data + linelen;
+	job.num_rows = num_rows;
+	job.group = png->segrows;
+	job.result = PNG_NO_ERROR;
+
+	if(num_rows > png->height - png->rows_read)
+		return PNG_ZLIB_ERROR; /* more data than the image holds */
+
+	/* rows that don't look at the row above start new chains, which are unfiltered in parallel */
+	for(i = 0; i < num_rows; i++)
+	{
+		unsigned char filter = job.lines[(size_t)i * linelen];
+
+		if(filter > PNG_FILTER_PAETH)
+			return PNG_UNKNOWN_FILTER;
+
+		if(i == 0 || filter == PNG_FILTER_NONE || filter == PNG_FILTER_SUB)
+			png->row_chains[num_chains++] = i;
+	}
+	png->row_chains[num_chains] = num_rows;
+
+	/* then the rows are passed on in groups, in parallel too, since converting them doesn't depend on
+	   other rows whatever the filters were */
+	parallel_for(num_chains, png->threads, png_unfilter_chain, &job);
+	parallel_for((num_rows + job.group - 1) / job.group, png->threads, png_pass_rows, &job);
 
-	(void)png_init_deflate;
-	(void)png_end_deflate;
-	(void)png_deflate;
+	if(job.result != PNG_NO_ERROR)
+		return job.result;
+
+	png->rows_read += num_rows;
+	memcpy(png->png_data, job.lines + (size_t)(num_rows - 1) * linelen, linelen);
+
+	return PNG_NO_ERROR;
+}
+
+static int png_inflate_rows(png_t* png, unsigned char* data, int len)
+{
+	/* png_data holds the row before the batch and the batch being inflated; full batches are passed on */
+	z_stream *stream = png->zs;
+	unsigned linelen = png->width * png->bpp + 1;
+	int zresult = Z_OK;
+	int result;
+
+	if(!stream)
+		return PNG_MEMORY_ERROR;
+
+	stream->next_in = data;
+	stream->avail_in = len;
 
-	chunk = png_alloc(chunk_size + 4);
-	memcpy(chunk, "IDAT", 4);
+	while(stream->avail_in != 0 && zresult != Z_STREAM_END)
+	{
+		zresult = inflate(stream, Z_SYNC_FLUSH);
 
-	written = chunk_size;
-	compress(chunk+4, &written, data, size);
+		if(zresult != Z_STREAM_END && zresult != Z_OK)
+		{
+			printf("%s\n", stream->msg);
+			return PNG_ZLIB_ERROR;
+		}
 
-	crc = crc32(0L, Z_NULL, 0);
-	crc = crc32(crc, chunk, written+4);
-	set_ul(chunk+written+4, crc);
-	file_write_ul(png, written);
-	file_write(png, chunk, 1, written+8);
-	png_free(chunk);
+		if(stream->avail_out == 0)
+		{
+			result = png_process_rows(png, png->png_datalen / linelen);
+			if(result != PNG_NO_ERROR)
+				return result;
 
-	file_write_ul(png, 0);
-	file_write(png, "IEND", 1, 4);
-	crc = crc32(0L, (const unsigned char *)"IEND", 4);
-	file_write_ul(png, crc);
+			stream->next_out = png->png_data + linelen;
+			stream->avail_out = png->png_datalen;
+		}
+	}
 
 	return PNG_NO_ERROR;
 }
 
+static int png_read_idat_mem(png_t* png, unsigned length)
+{
+	/* the chunk is inflated and checked where it is, its type just before it */
+	unsigned char* data = (unsigned char*)png->mem + png->mempos;
+	int result;
+#if DO_CRC_CHECKS
+	unsigned orig_crc;
+#endif
+
+	if(png->memlen - png->mempos < (size_t)length + 4)
+		return PNG_FILE_ERROR;
+
+#if DO_CRC_CHECKS
+	orig_crc = (data[length]<<24) | (data[length+1]<<16) | (data[length+2]<<8) | data[length+3];
+	if(png->verify_crc && orig_crc != png_crc32(0, data - 4, length + 4))
+		return PNG_CRC_ERROR;
+#endif
+
+	if(png->row_fun)
+		result = png_inflate_rows(png, data, length);
+	else
+		result = png_inflate(png, data, length);
+
+	png->mempos += (size_t)length + 4;
+
+	return result;
+}
+
 static int png_read_idat(png_t* png, unsigned length)
 {
+	/* the chunk is read and inflated in pieces of at most PNG_IDAT_SIZE bytes */
+	unsigned piece = length < PNG_IDAT_SIZE ? length : PNG_IDAT_SIZE;
+	int result = PNG_NO_ERROR;
 #if DO_CRC_CHECKS
 	unsigned orig_crc;
 	unsigned calc_crc;
 #endif
 
-	if(!png->readbuf || png->readbuflen < length)
+	if(png->mem)
+		return png_read_idat_mem(png, length);
+
+	if(!png->readbuf || png->readbuflen < piece)
 	{
 		if (png->readbuf)
 		{
 			png_free(png->readbuf);
 		}
-		png->readbuf = png_alloc(length);
-		png->readbuflen = length;
+		png->readbuf = png_alloc(piece);
+		png->readbuflen = piece;
 	}
 
 	if(!png->readbuf)
@@ -530,19 +868,39 @@ static int png_read_idat(png_t* png, unsigned length)
 		return PNG_MEMORY_ERROR;
 	}
 
-	if(file_read(png, png->readbuf, 1, length) != length)
+#if DO_CRC_CHECKS
+	calc_crc = png_crc32(0, (unsigned char*)"IDAT", 4);
+#endif
+
+	while(length != 0 && result == PNG_NO_ERROR)
 	{
-		return PNG_FILE_ERROR;
-	}
+		piece = length < png->readbuflen ? length : png->readbuflen;
+
+		if(file_read(png, png->readbuf, 1, piece) != piece)
+		{
+			return PNG_FILE_ERROR;
+		}
 
 #if DO_CRC_CHECKS
-	calc_crc = crc32(0L, Z_NULL, 0);
-	calc_crc = crc32(calc_crc, (unsigned char*)"IDAT", 4);
-	calc_crc = crc32(calc_crc, (unsigned char*)png->readbuf, length);
+		if(png->verify_crc)
+			calc_crc = png_crc32(calc_crc, png->readbuf, piece);
+#endif
 
+		if(png->row_fun)
+			result = png_inflate_rows(png, png->readbuf, piece);
+		else
+			result = png_inflate(png, png->readbuf, piece);
+
+		length -= piece;
+	}
+
+	if(result != PNG_NO_ERROR)
+		return result;
+
+#if DO_CRC_CHECKS
 	file_read_ul(png, &orig_crc);
 
-	if(orig_crc != calc_crc)
+	if(png->verify_crc && orig_crc != calc_crc)
 	{
 		return PNG_CRC_ERROR;
 	}
@@ -550,7 +908,7 @@ static int png_read_idat(png_t* png, unsigned length)
 	file_read_ul(png);
 #endif
 
-	return png_inflate(png, png->readbuf, length);
+	return PNG_NO_ERROR;
 }
 
 static int png_process_chunk(png_t* png)
@@ -596,243 +954,636 @@ static int png_process_chunk(png_t* png)
 	return result;
 }
 
-static void png_filter_sub(int stride, unsigned char* in, unsigned char* out, int len)
+static int png_unfilter(png_t* png, unsigned char* data)
 {
-	int i;
-	unsigned char a = 0;
+	unsigned i;
+	unsigned pos = 0;
+	unsigned outpos = 0;
+	unsigned char *filtered = png->png_data;
 
-	for(i = 0; i < len; i++)
+	int stride = png->bpp;
+
+	while(pos < png->png_datalen)
 	{
-		if(i >= stride)
-			a = out[i - stride];
+		unsigned char filter = filtered[pos];
+
+		pos++;
+
+		if(png->depth == 16)
+		{
+			for(i = 0; i < png->width * stride; i+=2)
+			{
+				*(short*)(filtered+pos+i) = (filtered[pos+i] << 8) | filtered[pos+i+1];
+			}
+		}
 
-		out[i] = in[i] + a;
+		if(filter > PNG_FILTER_PAETH)
+			return PNG_UNKNOWN_FILTER;
+
+		png_unfilter_row(filter, stride, filtered+pos, outpos ? data + outpos - (png->width*stride) : 0, data+outpos, png->width * stride);
+
+		outpos += png->width * stride;
+		pos += png->width * stride;
 	}
+
+	return PNG_NO_ERROR;
 }
 
-static void png_filter_up(int stride, unsigned char* in, unsigned char* out, unsigned char* prev_line, int len)
+int png_get_data(png_t* png, unsigned char* data)
 {
-	(void) stride;
+	int result = PNG_NO_ERROR;
 
-	int i;
+	png->row_fun = 0;
+	png->zs = NULL;
+	png->png_datalen = 0;
+	png->png_data = NULL;
+	png->readbuf = NULL;
+	png->readbuflen = 0;
 
-	if(prev_line)
+	while(result == PNG_NO_ERROR)
 	{
-        for(i = 0; i < len; i++)
-		out[i] = in[i] + prev_line[i];
+		result = png_process_chunk(png);
 	}
-	else
-		memcpy(out, in, len);
+
+	if (png->readbuf)
+	{
+		png_free(png->readbuf);
+		png->readbuflen = 0;
+	}
+	if (png->zs)
+	{
+		png_end_inflate(png);
+	}
+
+	if(result != PNG_DONE)
+	{
+		png_free(png->png_data);
+		return result;
+	}
+
+	result = png_unfilter(png, data);
+
+	png_free(png->png_data);
+
+	return result;
 }
 
-static void png_filter_average(int stride, unsigned char* in, unsigned char* out, unsigned char* prev_line, int len)
+int png_get_rows(png_t* png, png_row_callback_t row_fun, void* user_pointer)
 {
-	int i;
-	unsigned char a = 0;
-	unsigned char b = 0;
-	unsigned int sum = 0;
+	int result = PNG_NO_ERROR;
+	size_t linelen = (size_t)png->width * png->bpp + 1;
+	unsigned batch_rows;
+
+	png->row_fun = row_fun;
+	png->row_user_pointer = user_pointer;
+	png->rows_read = 0;
+	png->zs = NULL;
+	png->readbuf = NULL;
+	png->readbuflen = 0;
 
-	for(i = 0; i < len; i++)
+	/* rows are inflated in batches of about PNG_SEGMENT_SIZE bytes per thread, or one at a time with one
+	   thread; png_process_chunk won't allocate a buffer for the whole image since png_data is already set */
+	png->segrows = PNG_SEGMENT_SIZE / linelen;
+	if(png->segrows == 0)
+		png->segrows = 1;
+	batch_rows = png->threads > 1 ? png->threads * png->segrows : 1;
+	if(batch_rows > png->height)
+		batch_rows = png->height;
+
+	/* the row before the batch comes first */
+	png->png_datalen = (unsigned)(batch_rows * linelen);
+	png->png_data = png_alloc((batch_rows + 1) * linelen);
+	png->row_chains = png_alloc((batch_rows + 1) * sizeof(unsigned));
+	if(!png->png_data || !png->row_chains)
+		result = PNG_MEMORY_ERROR;
+
+	while(result == PNG_NO_ERROR)
 	{
-		if(prev_line)
-			b = prev_line[i];
+		result = png_process_chunk(png);
+	}
 
-		if(i >= stride)
-			a = out[i - stride];
+	/* the last batch may not have filled up */
+	if(result == PNG_DONE && png->zs)
+	{
+		z_stream *stream = png->zs;
+		unsigned inflated = png->png_datalen - stream->avail_out;
+
+		if(inflated % linelen != 0)
+			result = PNG_EOF_ERROR;
+		else if(inflated != 0)
+			result = png_process_rows(png, (unsigned)(inflated / linelen));
 
-		sum = a;
-		sum += b;
+		if(result == PNG_NO_ERROR)
+			result = PNG_DONE;
+	}
 
-		out[i] = (char)(in[i] + sum/2);
+	if (png->readbuf)
+	{
+		png_free(png->readbuf);
+		png->readbuflen = 0;
+	}
+	if (png->zs)
+	{
+		png_end_inflate(png);
 	}
+	png_free(png->png_data);
+	png->png_data = NULL;
+	png_free(png->row_chains);
+	png->row_chains = NULL;
+	png->row_fun = 0;
+
+	if(result != PNG_DONE)
+		return result;
+
+	return png->rows_read == png->height ? PNG_NO_ERROR : PNG_EOF_ERROR;
 }
 
-static unsigned char png_paeth(unsigned char a, unsigned char b, unsigned char c)
+static double png_trial_cost(z_stream* stream, unsigned char* line, unsigned len)
 {
-	int p = (int)a + b - c;
-	int pa = abs(p - a);
-	int pb = abs(p - b);
-	int pc = abs(p - c);
+	/* bytes the compressor would output for the line right now, found by compressing it with a copy of the
+	   compressor (whatever output is still pending counts for every line alike) */
+	z_stream trial;
+	unsigned char out[4096];
+	double bytes = 0;
+	int result;
 
-	int pr;
+	if(deflateCopy(&trial, stream) != Z_OK)
+		return 0;
 
-	if(pa <= pb && pa <= pc)
-		pr = a;
-	else if(pb <= pc)
-		pr = b;
-	else
-		pr = c;
+	trial.next_in = line;
+	trial.avail_in = len;
+
+	do
+	{
+		trial.next_out = out;
+		trial.avail_out = sizeof(out);
+		result = deflate(&trial, Z_SYNC_FLUSH);
+		bytes += sizeof(out) - trial.avail_out;
+	}
+	while(result == Z_OK && trial.avail_out == 0);
 
-	return (char)pr;
+	deflateEnd(&trial);
+
+	return bytes;
 }
 
-static void png_filter_paeth(int stride, unsigned char* in, unsigned char* out, unsigned char* prev_line, int len)
+static unsigned char* png_filter_line(png_t* png, unsigned char* filterbuf, z_stream* stream, unsigned char* row)
 {
-	int i;
-	unsigned char a;
-	unsigned char b;
-	unsigned char c;
+	/* filterbuf holds the previous row, then two lines of filter type byte plus filtered row;
+	   returns whichever line holds the chosen filter. stream is the compressor the line is for. */
+	static const int no_filters[] = { PNG_FILTER_NONE };
+	static const int fast_filters[] = { PNG_FILTER_SUB, PNG_FILTER_UP };
+	static const int all_filters[] = { PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVERAGE, PNG_FILTER_PAETH };
+	unsigned len = png->width * png->bpp;
+	unsigned char* prev = filterbuf;
+	unsigned char* best = prev + len;
+	unsigned char* trial = best + len + 1;
+	const int* filters = all_filters;
+	unsigned num_filters = 5;
+	double best_cost = 0;
+	unsigned i;
+
+	if(png->filter_mode == PNG_FILTER_MODE_NONE)
+	{
+		filters = no_filters;
+		num_filters = 1;
+	}
+	else if(png->filter_mode == PNG_FILTER_MODE_FAST)
+	{
+		filters = fast_filters;
+		num_filters = 2;
+	}
 
-	for(i = 0; i < len; i++)
+	for(i = 0; i < num_filters; i++)
 	{
-		if(prev_line && i >= stride)
+		double cost = (double)png_filter_row(filters[i], png->bpp, row, prev, trial + 1, len);
+		trial[0] = (unsigned char)filters[i];
+
+		if(png->filter_mode == PNG_FILTER_MODE_MAX)
+			cost = png_trial_cost(stream, trial, len + 1);
+
+		if(i == 0 || cost < best_cost)
 		{
-			a = out[i - stride];
-			b = prev_line[i];
-			c = prev_line[i - stride];
+			unsigned char* swap = best;
+			best = trial;
+			trial = swap;
+			best_cost = cost;
 		}
-		else
-		{
-			if(prev_line)
-				b = prev_line[i];
-			else
-				b = 0;
+	}
 
-			if(i >= stride)
-				a = out[i - stride];
-			else
-				a = 0;
+	memcpy(prev, row, len);
 
-			c = 0;
-		}
+	return best;
+}
 
-		out[i] = in[i] + png_paeth(a, b, c);
-	}
+int png_set_filter_mode(png_t* png, int mode)
+{
+	if(mode < PNG_FILTER_MODE_NONE || mode > PNG_FILTER_MODE_MAX)
+		return PNG_WRONG_ARGUMENTS;
+
+	png->filter_mode = mode;
+
+	return PNG_NO_ERROR;
 }
 
-static int png_filter(png_t* png, unsigned char* data)
+int png_set_compression(png_t* png, int level, int strategy)
 {
-	(void) png;
-	(void) data;
+	if(level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION)
+		return PNG_WRONG_ARGUMENTS;
+
+	if(strategy != Z_DEFAULT_STRATEGY && strategy != Z_FILTERED && strategy != Z_HUFFMAN_ONLY &&
+	   strategy != Z_RLE && strategy != Z_FIXED)
+		return PNG_WRONG_ARGUMENTS;
+
+	png->compression_level = level;
+	png->compression_strategy = strategy;
+
 	return PNG_NO_ERROR;
 }
 
-static int png_unfilter(png_t* png, unsigned char* data)
+int png_set_idat_size(png_t* png, unsigned size)
 {
-	unsigned i;
-	unsigned pos = 0;
-	unsigned outpos = 0;
-	unsigned char *filtered = png->png_data;
+	if(size == 0 || size > 0x7fffffff)
+		return PNG_WRONG_ARGUMENTS;
 
-	int stride = png->bpp;
+	png->idat_size = size;
 
-	while(pos < png->png_datalen)
+	return PNG_NO_ERROR;
+}
+
+int png_set_crc_check(png_t* png, int verify)
+{
+	png->verify_crc = verify != 0;
+
+	return PNG_NO_ERROR;
+}
+
+int png_set_threads(png_t* png, unsigned threads)
+{
+	if(threads == 0)
+		return PNG_WRONG_ARGUMENTS;
+
+	png->threads = threads;
+
+	return PNG_NO_ERROR;
+}
+
+static int png_write_idat_bytes(png_t* png, const unsigned char* data, unsigned len)
+{
+	/* adds already compressed bytes to the IDAT buffer, writing an IDAT every time it fills up */
+	while(len != 0)
 	{
-		unsigned char filter = filtered[pos];
+		unsigned n = png->idat_size - png->idatlen;
 
-		pos++;
+		if(n > len)
+			n = len;
 
-		if(png->depth == 16)
-		{
-			for(i = 0; i < png->width * stride; i+=2)
-			{
-				*(short*)(filtered+pos+i) = (filtered[pos+i] << 8) | filtered[pos+i+1];
-			}
-		}
+		memcpy(png->idatbuf + 4 + png->idatlen, data, n);
+		png->idatlen += n;
+		data += n;
+		len -= n;
+
+		if(png->idatlen == png->idat_size && png_flush_idat(png) != PNG_NO_ERROR)
+			return PNG_FILE_ERROR;
+	}
+
+	return PNG_NO_ERROR;
+}
 
-		switch(filter)
+static void png_free_segments(png_t* png)
+{
+	png_segment_t* segs = png->segs;
+	unsigned i;
+
+	if(segs)
+	{
+		for(i = 0; i < png->threads; i++)
 		{
-		case 0: /* none */
-			memcpy(data+outpos, filtered+pos, png->width * stride);
-			break;
-		case 1: /* sub */
-			png_filter_sub(stride, filtered+pos, data+outpos, png->width * stride);
-			break;
-		case 2: /* up */
-			if(outpos)
-				png_filter_up(stride, filtered+pos, data+outpos, data + outpos - (png->width*stride), png->width*stride);
-			else
-				png_filter_up(stride, filtered+pos, data+outpos, 0, png->width*stride);
-			break;
-		case 3: /* average */
-			if(outpos)
-				png_filter_average(stride, filtered+pos, data+outpos, data + outpos - (png->width*stride), png->width*stride);
-			else
-				png_filter_average(stride, filtered+pos, data+outpos, 0, png->width*stride);
-			break;
-		case 4: /* paeth */
-			if(outpos)
-				png_filter_paeth(stride, filtered+pos, data+outpos, data + outpos - (png->width*stride), png->width*stride);
-			else
-				png_filter_paeth(stride, filtered+pos, data+outpos, 0, png->width*stride);
-			break;
-		default:
-			return PNG_UNKNOWN_FILTER;
+			if(segs[i].zs.state)
+				deflateEnd(&segs[i].zs);
+			png_free(segs[i].filterbuf);
+			png_free(segs[i].dictbuf);
+			png_free(segs[i].out);
 		}
-
-		outpos += png->width * stride;
-		pos += png->width * stride;
+		png_free(segs);
 	}
+	png->segs = 0;
 
-	return PNG_NO_ERROR;
+	png_free(png->segbuf);
+	png->segbuf = 0;
 }
 
-int png_get_data(png_t* png, unsigned char* data)
+static int png_init_segments(png_t* png)
 {
-	int result = PNG_NO_ERROR;
+	/* in the style of pigz: rows are split into segments that are filtered and compressed as raw deflate
+	   data by separate threads, each segment ending in a sync flush (so at a byte boundary) and the last one
+	   in the final block. Concatenated, with a zlib header in front and the adler32 of all the filtered
+	   bytes, combined from each segment's, behind, they are one zlib stream. Each thread filters the last
+	   32 KiB of rows before its segment again to use as the dictionary, so matches can still reach back
+	   into the segment before. Filters picked by trial compression depend on the compressor, so they can't
+	   be found again that way, and with PNG_FILTER_MODE_MAX segments are compressed without one. */
+	unsigned len = png->width * png->bpp;
+	unsigned char header[2];
+	png_segment_t* segs;
+	unsigned flevel;
+	unsigned i;
 
-	png->zs = NULL;
-	png->png_datalen = 0;
-	png->png_data = NULL;
-	png->readbuf = NULL;
-	png->readbuflen = 0;
+	png->segrows = PNG_SEGMENT_SIZE / (len + 1);
+	if(png->segrows == 0)
+		png->segrows = 1;
+	png->histrows = 1;
+	if(png->filter_mode != PNG_FILTER_MODE_MAX)
+		png->histrows += (32768 + len) / (len + 1);
+	png->pending_rows = 0;
+	png->adler = adler32(0L, Z_NULL, 0);
+
+	/* the rows before the pending ones come first, all zeros above the first row */
+	png->segbuf = png_alloc(((size_t)png->threads * png->segrows + png->histrows) * len);
+	png->segs = png_alloc(png->threads * sizeof(png_segment_t));
+	if(!png->segbuf || !png->segs)
+		return PNG_MEMORY_ERROR;
+	memset(png->segbuf, 0, (size_t)png->histrows * len);
 
-	while(result == PNG_NO_ERROR)
+	segs = png->segs;
+	memset(segs, 0, png->threads * sizeof(png_segment_t));
+	for(i = 0; i < png->threads; i++)
 	{
-		result = png_process_chunk(png);
+		if(deflateInit2(&segs[i].zs, png->compression_level, Z_DEFLATED, -15, 8, png->compression_strategy) != Z_OK)
+			return PNG_ZLIB_ERROR;
+
+		/* room for the worst case, plus the empty stored block of the sync flush */
+		segs[i].outcap = deflateBound(&segs[i].zs, (uLong)png->segrows * (len + 1)) + 16;
+		segs[i].out = png_alloc(segs[i].outcap);
+		segs[i].filterbuf = png_alloc(3 * (size_t)len + 2);
+		segs[i].dictbuf = png_alloc((size_t)png->histrows * (len + 1));
+		if(!segs[i].out || !segs[i].filterbuf || !segs[i].dictbuf)
+			return PNG_MEMORY_ERROR;
 	}
 
-	if (png->readbuf)
+	/* the zlib header deflateInit would have written: 32K window, and the level as FLEVEL */
+	if((png->compression_level >= 0 && png->compression_level < 2) || png->compression_strategy >= Z_HUFFMAN_ONLY)
+		flevel = 0;
+	else if(png->compression_level >= 2 && png->compression_level <= 5)
+		flevel = 1;
+	else if(png->compression_level >= 7)
+		flevel = 3;
+	else
+		flevel = 2;
+	header[0] = 0x78;
+	header[1] = (unsigned char)(flevel << 6);
+	header[1] += 31 - (header[0] * 256 + header[1]) % 31;
+
+	return png_write_idat_bytes(png, header, 2);
+}
+
+static void png_deflate_segment(void* arg, uint32_t index)
+{
+	png_t* png = arg;
+	png_segment_t* seg = (png_segment_t*)png->segs + index;
+	z_stream* stream = &seg->zs;
+	unsigned len = png->width * png->bpp;
+	int result = Z_OK;
+	unsigned i;
+
+	deflateReset(stream);
+	stream->next_out = seg->out;
+	stream->avail_out = seg->outcap;
+	seg->adler = adler32(0L, Z_NULL, 0);
+
+	/* filter the dictionary rows the same way the thread before did; that leaves the row before the
+	   segment in filterbuf, for the segment's filters to be chosen as they would be without threads */
+	memcpy(seg->filterbuf, png->segbuf + (size_t)(seg->first_row - seg->dict_rows - 1) * len, len);
+	for(i = 0; i < seg->dict_rows; i++)
 	{
-		png_free(png->readbuf);
-		png->readbuflen = 0;
+		unsigned char* row = png->segbuf + (size_t)(seg->first_row - seg->dict_rows + i) * len;
+		memcpy(seg->dictbuf + (size_t)i * (len + 1), png_filter_line(png, seg->filterbuf, stream, row), len + 1);
 	}
-	if (png->zs)
+	if(seg->dict_rows != 0)
+		deflateSetDictionary(stream, seg->dictbuf, seg->dict_rows * (len + 1));
+
+	for(i = 0; i < seg->num_rows && (result == Z_OK || result == Z_STREAM_END); i++)
 	{
-		png_end_inflate(png);
+		int flush = Z_NO_FLUSH;
+
+		if(i + 1 == seg->num_rows)
+			flush = seg->last ? Z_FINISH : Z_SYNC_FLUSH;
+
+		stream->next_in = png_filter_line(png, seg->filterbuf, stream, png->segbuf + (size_t)(seg->first_row + i) * len);
+		stream->avail_in = len + 1;
+		seg->adler = adler32(seg->adler, stream->next_in, len + 1);
+
+		result = deflate(stream, flush);
 	}
 
-	if(result != PNG_DONE)
+	seg->outlen = seg->outcap - stream->avail_out;
+
+	/* everything must have fit in the output buffer, and the last segment must have ended the stream */
+	if((result != Z_OK && result != Z_STREAM_END) || stream->avail_in != 0 || stream->avail_out == 0 ||
+	   (seg->last && result != Z_STREAM_END))
+		seg->result = PNG_ZLIB_ERROR;
+	else
+		seg->result = PNG_NO_ERROR;
+}
+
+static int png_write_segments(png_t* png, int last)
+{
+	/* compresses the pending rows, one segment per thread, then writes the segments in order */
+	png_segment_t* segs = png->segs;
+	unsigned len = png->width * png->bpp;
+	unsigned num_segs = (png->pending_rows + png->segrows - 1) / png->segrows;
+	unsigned rows_before = png->rows_written - png->pending_rows;
+	unsigned i;
+	int result;
+
+	for(i = 0; i < num_segs; i++)
 	{
-		png_free(png->png_data);
-		return result;
+		segs[i].first_row = png->histrows + i * png->segrows;
+		segs[i].dict_rows = rows_before + i * png->segrows;
+		if(segs[i].dict_rows > png->histrows - 1)
+			segs[i].dict_rows = png->histrows - 1;
+		segs[i].num_rows = png->pending_rows - i * png->segrows;
+		if(segs[i].num_rows > png->segrows)
+			segs[i].num_rows = png->segrows;
+		segs[i].last = last && i + 1 == num_segs;
 	}
 
-	result = png_unfilter(png, data);
+	parallel_for(num_segs, png->threads, png_deflate_segment, png);
 
-	png_free(png->png_data);
+	for(i = 0; i < num_segs; i++)
+	{
+		if(segs[i].result != PNG_NO_ERROR)
+			return segs[i].result;
 
-	return result;
+		result = png_write_idat_bytes(png, segs[i].out, segs[i].outlen);
+		if(result != PNG_NO_ERROR)
+			return result;
+
+		png->adler = adler32_combine(png->adler, segs[i].adler, (z_off_t)segs[i].num_rows * (len + 1));
+	}
+
+	/* the last rows are the ones before the next segment */
+	memmove(png->segbuf, png->segbuf + (size_t)png->pending_rows * len, (size_t)png->histrows * len);
+	png->pending_rows = 0;
+
+	return PNG_NO_ERROR;
 }
 
-int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int color, unsigned char* data)
+int png_write_begin(png_t* png, unsigned width, unsigned height, char depth, int color)
 {
-	//int i;
-	unsigned i;
-	unsigned char *filtered;
+	int bpp;
+	int result;
+
 	png->width = width;
 	png->height = height;
 	png->depth = depth;
 	png->color_type = color;
-	png->bpp = png_get_bpp(png);
+	png->zs = 0;
+	png->idatbuf = 0;
+	png->idatlen = 0;
+	png->filterbuf = 0;
+	png->segs = 0;
+	png->segbuf = 0;
+	png->rows_written = 0;
+
+	bpp = png_get_bpp(png);
+	if(bpp <= 0)
+		return PNG_NOT_SUPPORTED;
+	png->bpp = (unsigned char)bpp;
+
+	png->idatbuf = png_alloc((size_t)png->idat_size + 4);
+	png->filterbuf = png_alloc(3 * (size_t)width * png->bpp + 2);
+	if(!png->idatbuf || !png->filterbuf)
+	{
+		png_write_cleanup(png);
+		return PNG_MEMORY_ERROR;
+	}
+	memcpy(png->idatbuf, "IDAT", 4);
+
+	/* the row above the first row counts as all zeros */
+	memset(png->filterbuf, 0, (size_t)width * png->bpp);
+
+	result = png_write_ihdr(png);
+	if(result == PNG_NO_ERROR && png->threads > 1)
+		result = png_init_segments(png);
+	else if(result == PNG_NO_ERROR)
+		result = png_init_deflate(png, 0, 0);
+
+	if(result != PNG_NO_ERROR)
+		png_write_cleanup(png);
 
-	filtered = png_alloc(width * height * png->bpp + height);
+	return result;
+}
+
+int png_write_rows(png_t* png, unsigned char* data, unsigned num_rows)
+{
+	z_stream *stream = png->zs;
+	unsigned i;
+	int result;
 
-	for(i = 0; i < png->height; i++)
+	if((!stream && !png->segs) || num_rows > png->height - png->rows_written)
+		return PNG_WRONG_ARGUMENTS;
+
+	if(png->segs)
 	{
-		filtered[i*png->width*png->bpp+i] = 0;
-		memcpy(&filtered[i*png->width*png->bpp+i+1], data + i * png->width*png->bpp, png->width*png->bpp);
+		unsigned len = png->width * png->bpp;
+
+		for(i = 0; i < num_rows; i++)
+		{
+			/* compress a full batch only once another row comes, so that png_write_finish always has
+			   rows left to end the stream with */
+			if(png->pending_rows == png->threads * png->segrows)
+			{
+				result = png_write_segments(png, 0);
+				if(result != PNG_NO_ERROR)
+					return result;
+			}
+
+			memcpy(png->segbuf + (size_t)(png->histrows + png->pending_rows) * len, data + (size_t)i * len, len);
+			png->pending_rows++;
+			png->rows_written++;
+		}
+
+		return PNG_NO_ERROR;
 	}
 
-	png_filter(png, filtered);
-	png_write_ihdr(png);
-	png_write_idats(png, filtered);
+	for(i = 0; i < num_rows; i++)
+	{
+		/* each row is compressed as its filter type followed by the filtered row */
+		stream->next_in = png_filter_line(png, png->filterbuf, stream, data + (size_t)i * png->width * png->bpp);
+		stream->avail_in = png->width * png->bpp + 1;
+		result = png_write_deflate(png, Z_NO_FLUSH);
 
-	png_free(filtered);
+		if(result != PNG_NO_ERROR)
+			return result;
+
+		png->rows_written++;
+	}
 
 	return PNG_NO_ERROR;
 }
 
+int png_write_finish(png_t* png)
+{
+	int result = PNG_WRONG_ARGUMENTS;
+
+	if(png->segs && png->rows_written == png->height)
+	{
+		unsigned char trailer[4];
+
+		result = png_write_segments(png, 1);
+
+		trailer[0] = (unsigned char)(png->adler >> 24);
+		trailer[1] = (unsigned char)(png->adler >> 16);
+		trailer[2] = (unsigned char)(png->adler >> 8);
+		trailer[3] = (unsigned char)png->adler;
+
+		if(result == PNG_NO_ERROR)
+			result = png_write_idat_bytes(png, trailer, 4);
+
+		if(result == PNG_NO_ERROR)
+			result = png_flush_idat(png);
+
+		if(result == PNG_NO_ERROR)
+			result = png_write_chunk(png, (unsigned char*)"IEND", 0);
+	}
+	else if(png->zs && png->rows_written == png->height)
+	{
+		z_stream *stream = png->zs;
+
+		stream->next_in = 0;
+		stream->avail_in = 0;
+		result = png_write_deflate(png, Z_FINISH);
+
+		if(result == PNG_NO_ERROR)
+			result = png_flush_idat(png);
+
+		if(result == PNG_NO_ERROR)
+			result = png_write_chunk(png, (unsigned char*)"IEND", 0);
+	}
+
+	png_write_cleanup(png);
+
+	return result;
+}
+
+int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int color, unsigned char* data)
+{
+	int result = png_write_begin(png, width, height, depth, color);
+
+	if(result != PNG_NO_ERROR)
+		return result;
+
+	result = png_write_rows(png, data, height);
+
+	if(result != PNG_NO_ERROR)
+	{
+		png_write_finish(png);
+		return result;
+	}
+
+	return png_write_finish(png);
+}
+
 char* png_error_string(int error)
 {
 	switch(error)
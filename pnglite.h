@@ -73,12 +73,25 @@ enum
 	PNG_TRUECOLOR_ALPHA		= 6
 };
 
+/*
+	How hard png writing works at choosing a filter for each row.
+*/
+
+enum
+{
+	PNG_FILTER_MODE_NONE		= 0,	/* no filtering (default) */
+	PNG_FILTER_MODE_FAST		= 1,	/* cheapest filters only */
+	PNG_FILTER_MODE_BALANCED	= 2,	/* every filter, picked by sum of absolute differences */
+	PNG_FILTER_MODE_MAX		= 3	/* every filter, picked by trial compression */
+};
+
 /*
 	Typedefs for callbacks.
 */
 
 typedef unsigned (*png_write_callback_t)(void* input, size_t size, size_t numel, void* user_pointer);
 typedef unsigned (*png_read_callback_t)(void* output, size_t size, size_t numel, void* user_pointer);
+typedef int (*png_row_callback_t)(unsigned char* row, unsigned y, void* user_pointer);
 typedef void (*png_free_t)(void* p);
 typedef void * (*png_alloc_t)(size_t s);
 
@@ -103,6 +116,33 @@ typedef struct
 
 	unsigned char*			readbuf;
 	unsigned			readbuflen;
+
+	const unsigned char*		mem;			/* whole file, when reading from memory */
+	size_t				memlen;
+	size_t				mempos;			/* next byte to read */
+	int				mem_mapped;		/* mem was mapped by png_open_file_read */
+	int				verify_crc;		/* check the CRCs of IDAT chunks */
+
+	unsigned char*			idatbuf;		/* "IDAT" followed by compressed data not yet written */
+	unsigned			idatlen;
+	unsigned			rows_written;
+	int				filter_mode;
+	unsigned char*			filterbuf;		/* previous row and two filtered rows */
+	int				compression_level;
+	int				compression_strategy;
+	unsigned			idat_size;		/* most compressed bytes per IDAT chunk */
+	unsigned			threads;		/* segments compressed at once */
+	void*				segs;			/* each thread's compressor */
+	unsigned char*			segbuf;			/* histrows rows before the pending rows, then the pending rows */
+	unsigned			segrows;		/* rows per segment */
+	unsigned			histrows;
+	unsigned			pending_rows;
+	unsigned long			adler;			/* adler32 of the filtered bytes compressed so far */
+
+	png_row_callback_t		row_fun;		/* set while png_get_rows runs */
+	void*				row_user_pointer;
+	unsigned			rows_read;
+	unsigned*			row_chains;		/* first row of each chain of dependent rows in a batch */
 } png_t;
 
 /*
@@ -174,6 +214,24 @@ int png_open(png_t* png, png_read_callback_t read_fun, void* user_pointer);
 int png_open_read(png_t* png, png_read_callback_t read_fun, void* user_pointer);
 int png_open_write(png_t* png, png_write_callback_t write_fun, void* user_pointer);
 
+/*
+	Function: png_open_mem_read
+
+	This function reads a png that is already in memory. IDAT chunks are inflated straight from it, and their CRCs are
+	checked in place, so no compressed data is ever copied. The memory must stay valid until decoding is done.
+	png_open_file_read does this with a mapping of the file where it can (the mapping is released by png_close_file).
+
+	Parameters:
+		png - Empty png_t struct.
+		data - The whole png file.
+		len - Size of the file in bytes.
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise an error code.
+*/
+
+int png_open_mem_read(png_t* png, const void* data, size_t len);
+
 /*
 	Function: png_print_info
 
@@ -215,12 +273,183 @@ char* png_error_string(int error);
 
 int png_get_data(png_t* png, unsigned char* data);
 
+/*
+	Function: png_get_rows
+
+	This function decodes the opened png file one row at a time. Each row is inflated and unfiltered as soon as its
+	data has been read, and passed to row_fun, top to bottom:
+
+	> int (*png_row_callback_t)(unsigned char* row, unsigned y, void* user_pointer)
+
+	The row holds width*(bytes per pixel) bytes in PNG order and is only valid during the call. Only two rows (and a
+	piece of the compressed data) are ever held in memory. If the callback returns anything but PNG_NO_ERROR,
+	decoding stops and that value is returned.
+
+	With png_set_threads above 1, rows are instead inflated in batches of about 256 KiB per thread. Rows filtered
+	with None or Sub don't depend on the row above, so each one starts a chain of rows that is unfiltered on its
+	own thread, and then the rows are passed to row_fun from all the threads at once, in no particular order
+	within a batch. row_fun must be safe to call that way (writing each row to its own place is).
+
+	Parameters:
+		png - png_t struct opened for reading
+		row_fun - Callback function for each row.
+		user_pointer - User pointer to be passed to row_fun.
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise an error code.
+*/
+
+int png_get_rows(png_t* png, png_row_callback_t row_fun, void* user_pointer);
+
 int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int color, unsigned char* data);
 
+/*
+	Function: png_set_filter_mode
+
+	This function sets how rows are filtered by png_write_begin/png_set_data. Call it after opening the png for
+	writing. The sum of absolute differences heuristic suits photos and gradients, but flat fills and pixel art
+	often compress best unfiltered, which is why that is the default. PNG_FILTER_MODE_MAX compresses each row
+	with every filter to pick one, so it never does much worse than no filtering but is far slower.
+
+	Parameters:
+		png - png_t struct opened for writing
+		mode - PNG_FILTER_MODE_NONE, PNG_FILTER_MODE_FAST, PNG_FILTER_MODE_BALANCED, or PNG_FILTER_MODE_MAX
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise PNG_WRONG_ARGUMENTS.
+*/
+
+int png_set_filter_mode(png_t* png, int mode);
+
+/*
+	Function: png_set_compression
+
+	This function sets the zlib compression level and strategy used by png_write_begin/png_set_data. Call it after
+	opening the png for writing. The defaults are Z_DEFAULT_COMPRESSION and Z_DEFAULT_STRATEGY. Z_RLE only finds
+	runs of repeated bytes, which is much faster and still works well on flat fills.
+
+	Parameters:
+		png - png_t struct opened for writing
+		level - 0 (no compression) to 9 (smallest), or Z_DEFAULT_COMPRESSION (-1)
+		strategy - Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, or Z_FIXED
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise PNG_WRONG_ARGUMENTS.
+*/
+
+int png_set_compression(png_t* png, int level, int strategy);
+
+/*
+	Function: png_set_idat_size
+
+	This function sets the largest amount of compressed data written in one IDAT chunk, which is also the size of
+	the buffer holding it. The default is 64 KiB.
+
+	Parameters:
+		png - png_t struct opened for writing
+		size - bytes per IDAT chunk, from 1 to 2^31 - 1
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise PNG_WRONG_ARGUMENTS.
+*/
+
+int png_set_idat_size(png_t* png, unsigned size);
+
+/*
+	Function: png_set_crc_check
+
+	This function sets whether the CRCs of IDAT chunks are checked while decoding, which they are by default. Turning
+	it off saves a pass over the compressed data, and is only meant for files that can be trusted, like a local cache
+	this program wrote itself (inflate still checks the adler32 of the whole image). The IHDR is always checked, since
+	it is read when the png is opened.
+
+	Parameters:
+		png - png_t struct opened for reading
+		verify - 0 to skip the checks, anything else to check
+
+	Returns:
+		PNG_NO_ERROR
+*/
+
+int png_set_crc_check(png_t* png, int verify);
+
+/*
+	Function: png_set_threads
+
+	This function sets how many threads png_write_begin/png_set_data compress with, and how many threads
+	png_get_rows unfilters and passes rows on with (see there). Call it after opening the png. For writing, rows are
+	split into segments of about 256 KiB that are filtered and compressed at the same time, each with the 32 KiB
+	before it as its dictionary, then joined into one zlib stream. The file is a little bigger, since the
+	compressor restarts at every segment (and more so with PNG_FILTER_MODE_MAX, which can't use a dictionary).
+	Images that fit in one segment come out exactly the same as with one thread. The default is 1.
+
+	Parameters:
+		png - png_t struct opened for reading or writing
+		threads - number of threads, at least 1
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise PNG_WRONG_ARGUMENTS.
+*/
+
+int png_set_threads(png_t* png, unsigned threads);
+
+/*
+	Function: png_write_begin
+
+	This function starts writing a png to a png_t opened for writing, one group of rows at a time. It writes the
+	header, and the rows are then passed to png_write_rows, top to bottom, and compressed as they arrive into IDAT
+	chunks of up to 64 KiB (see png_set_idat_size). Only a few rows are ever held in memory. If this function succeeds, png_write_finish
+	must be called to release the compressor, even if writing the rows fails.
+
+	Parameters:
+		png - png_t struct opened for writing
+		width - width in pixels
+		height - height in pixels
+		depth - bits per channel (8 or 16)
+		color - one of the color storage kinds, e.g. PNG_TRUECOLOR_ALPHA
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise an error code.
+*/
+
+int png_write_begin(png_t* png, unsigned width, unsigned height, char depth, int color);
+
+/*
+	Function: png_write_rows
+
+	This function compresses the next rows of a png started with png_write_begin.
+
+	Parameters:
+		png - png_t struct
+		data - the rows, width*(bytes per pixel) bytes each, one after the other
+		num_rows - number of rows in data
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise an error code.
+*/
+
+int png_write_rows(png_t* png, unsigned char* data, unsigned num_rows);
+
+/*
+	Function: png_write_finish
+
+	This function flushes the compressor, writes the last IDAT chunk and the IEND chunk, and releases the
+	memory used for writing. It fails (but still releases everything) if fewer rows than the height were written.
+
+	Parameters:
+		png - png_t struct
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise an error code.
+*/
+
+int png_write_finish(png_t* png);
+
 /*
 	Function: png_close_file
 
-	Closes an open png file pointer. Should only be used when the png has been opened with png_open_file.
+	Closes an open png file pointer, or releases the mapping of the file. Should only be used when the png has been
+	opened with png_open_file.
 
 	Parameters:
 		png - png to close.
@@ -0,0 +1,241 @@
+/*
+ * CRC32 for PNG chunks
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+// The CRC of every chunk is checked when reading and computed
+// when writing, which for IDAT means every compressed byte.
+//
+// Slice-by-8 looks up 8 tables for 8 bytes at once instead of one
+// table per byte, so the lookups don't wait on each other. With
+// PCLMULQDQ, the CRC is a carry-less product: 64 bytes are folded
+// into the next 64 by multiplying by x^(512+32) and x^(512-32)
+// modulo the CRC polynomial, then the last 64 bytes are folded
+// down to 128 bits, 64 bits, and reduced to 32 (Barrett
+// reduction). This is Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ", with its constants for the
+// bit-reflected CRC32 polynomial that PNG and zlib use.
+
+#include <string.h>
+#include "pnglite_crc.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PNG_CRC_X86 1
+#else
+#define PNG_CRC_X86 0
+#endif
+
+// the CRC32 polynomial, bit-reflected
+#define CRC32_POLY 0xedb88320U
+
+// crc_tables[0] is the usual byte-at-a-time table; crc_tables[k]
+// advances a byte that is followed by k more bytes
+static uint32_t crc_tables[8][256];
+
+struct PngCrcImpl {
+  const char *name;
+  // continues the CRC with the bits not inverted (as kept between
+  // bytes), returning how many bytes were done; slice-by-8 does
+  // the rest
+  size_t (*update)(uint32_t *state, const unsigned char *buf, size_t len);
+};
+
+////////////////////////////////////////////////////////////////////////
+// Slice-by-8
+////////////////////////////////////////////////////////////////////////
+
+//
+// Builds the slice-by-8 tables.
+//
+static void init_crc_tables(void) {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+    }
+    crc_tables[0][n] = c;
+  }
+  for (uint32_t n = 0; n < 256; n++) {
+    for (int k = 1; k < 8; k++) {
+      uint32_t c = crc_tables[k - 1][n];
+      crc_tables[k][n] = (c >> 8) ^ crc_tables[0][c & 0xFF];
+    }
+  }
+}
+
+//
+// Reads 4 bytes as a little-endian number (one load on x86).
+//
+static inline uint32_t load_le32(const unsigned char *p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void crc_update_slice8(uint32_t *state, const unsigned char *buf, size_t len) {
+  uint32_t c = *state;
+
+  for (; len >= 8; len -= 8, buf += 8) {
+    uint32_t one = load_le32(buf) ^ c;
+    uint32_t two = load_le32(buf + 4);
+    c = crc_tables[7][one & 0xFF] ^ crc_tables[6][(one >> 8) & 0xFF] ^
+        crc_tables[5][(one >> 16) & 0xFF] ^ crc_tables[4][one >> 24] ^
+        crc_tables[3][two & 0xFF] ^ crc_tables[2][(two >> 8) & 0xFF] ^
+        crc_tables[1][(two >> 16) & 0xFF] ^ crc_tables[0][two >> 24];
+  }
+  for (; len > 0; len--, buf++) {
+    c = (c >> 8) ^ crc_tables[0][(c ^ *buf) & 0xFF];
+  }
+
+  *state = c;
+}
+
+#if PNG_CRC_X86
+
+////////////////////////////////////////////////////////////////////////
+// PCLMULQDQ folding (64 bytes per iteration)
+////////////////////////////////////////////////////////////////////////
+
+// x^(4*128+32) and x^(4*128-32) mod P (folding by 64 bytes),
+// x^(128+32) and x^(128-32) mod P (folding by 16 bytes),
+// x^64 mod P (folding 64 bits to 32), and P with floor(x^64 / P)
+// for the Barrett reduction, all bit-reflected
+static const uint64_t k1k2[2] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+static const uint64_t k3k4[2] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+static const uint64_t k5k0[2] = { 0x0163cd6124ULL, 0 };
+static const uint64_t poly[2] = { 0x01db710641ULL, 0x01f7011641ULL };
+
+//
+// Folds x into the 128 bits 16 bytes further on (next), with the
+// multipliers k.
+//
+__attribute__((target("sse2,pclmul"), always_inline))
+static inline __m128i fold_16(__m128i x, __m128i next, __m128i k) {
+  __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+  __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+  return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+__attribute__((target("sse2,pclmul")))
+static size_t crc_update_pclmul(uint32_t *state, const unsigned char *buf, size_t len) {
+  if (len < 64) {
+    return 0;
+  }
+  len &= ~(size_t) 15;
+  size_t done = len;
+
+  // four lanes of 128 bits, the CRC so far going into the first
+  __m128i x1 = _mm_loadu_si128((const __m128i *) buf);
+  __m128i x2 = _mm_loadu_si128((const __m128i *) (buf + 16));
+  __m128i x3 = _mm_loadu_si128((const __m128i *) (buf + 32));
+  __m128i x4 = _mm_loadu_si128((const __m128i *) (buf + 48));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) *state));
+  buf += 64;
+  len -= 64;
+
+  __m128i k = _mm_loadu_si128((const __m128i *) k1k2);
+  for (; len >= 64; len -= 64, buf += 64) {
+    x1 = fold_16(x1, _mm_loadu_si128((const __m128i *) buf), k);
+    x2 = fold_16(x2, _mm_loadu_si128((const __m128i *) (buf + 16)), k);
+    x3 = fold_16(x3, _mm_loadu_si128((const __m128i *) (buf + 32)), k);
+    x4 = fold_16(x4, _mm_loadu_si128((const __m128i *) (buf + 48)), k);
+  }
+
+  // fold the lanes into one, then the remaining 16 byte blocks
+  k = _mm_loadu_si128((const __m128i *) k3k4);
+  x1 = fold_16(x1, x2, k);
+  x1 = fold_16(x1, x3, k);
+  x1 = fold_16(x1, x4, k);
+  for (; len >= 16; len -= 16, buf += 16) {
+    x1 = fold_16(x1, _mm_loadu_si128((const __m128i *) buf), k);
+  }
+
+  // 128 bits to 64
+  const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+  x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+  // 64 bits to 32
+  k = _mm_loadu_si128((const __m128i *) k5k0);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction
+  k = _mm_loadu_si128((const __m128i *) poly);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  *state = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+  return done;
+}
+
+#endif // PNG_CRC_X86
+
+////////////////////////////////////////////////////////////////////////
+// Runtime dispatch
+////////////////////////////////////////////////////////////////////////
+
+static const struct PngCrcImpl impls[] = {
+#if PNG_CRC_X86
+  { "pclmul", crc_update_pclmul },
+#endif
+  { "slice8", NULL },
+};
+
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static const struct PngCrcImpl *current_impl = &impls[NUM_IMPLS - 1];
+
+//
+// Checks whether the CPU can run the named implementation.
+//
+static int impl_supported(const char *name) {
+#if PNG_CRC_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "pclmul") == 0) {
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+  }
+#endif
+  return strcmp(name, "slice8") == 0;
+}
+
+//
+// Builds the tables and picks the fastest supported
+// implementation at program startup.
+//
+__attribute__((constructor))
+static void png_crc_init(void) {
+  init_crc_tables();
+  for (unsigned i = 0; i < NUM_IMPLS; i++) {
+    if (impl_supported(impls[i].name)) {
+      current_impl = &impls[i];
+      return;
+    }
+  }
+}
+
+int png_crc_select(const char *name) {
+  for (unsigned i = 0; i < NUM_IMPLS; i++) {
+    if (strcmp(impls[i].name, name) == 0 && impl_supported(name)) {
+      current_impl = &impls[i];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+const char *png_crc_impl(void) {
+  return current_impl->name;
+}
+
+uint32_t png_crc32(uint32_t crc, const unsigned char *buf, size_t len) {
+  uint32_t state = ~crc;
+  size_t done = current_impl->update != NULL ? current_impl->update(&state, buf, len) : 0;
+  crc_update_slice8(&state, buf + done, len - done);
+  return ~state;
+}
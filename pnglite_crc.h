@@ -0,0 +1,45 @@
+/*
+ * CRC32 for PNG chunks
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef PNGLITE_CRC_H
+#define PNGLITE_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compute or continue the CRC32 of PNG chunks (the same CRC as
+// zlib's crc32, which it can replace: start with crc = 0 and pass
+// each result on to continue).
+//
+// Parameters:
+//   crc - CRC of the bytes before buf, or 0 to start
+//   buf - the bytes to add
+//   len - number of bytes
+//
+// Returns:
+//   CRC of the bytes so far
+uint32_t png_crc32(uint32_t crc, const unsigned char *buf, size_t len);
+
+// Select the CRC32 implementation. By default the fastest one
+// supported by the CPU is chosen ("pclmul", folding 64 bytes at a
+// time with carry-less multiplies, then "slice8", a table lookup
+// per byte of 8 bytes at a time).
+//
+// Parameters:
+//   name - "pclmul" or "slice8"
+//
+// Returns:
+//   1 if the implementation was selected, 0 if it is unknown or
+//   not supported on this CPU
+int png_crc_select(const char *name);
+
+// Returns:
+//   the name of the CRC32 implementation currently in use
+const char *png_crc_impl(void);
+
+#endif // PNGLITE_CRC_H
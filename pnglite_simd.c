@@ -0,0 +1,729 @@
+/*
+ * SIMD kernels for PNG row filters
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+// Filtering a row for writing only reads the original rows, so
+// every byte is independent and the filters vectorize directly:
+// a, b, and c (the bytes to the left, above, and above-left) are
+// just unaligned loads at an offset of bpp.
+//
+// Unfiltering is harder, since a is a byte that was just
+// unfiltered. Up has no such dependency. Sub is a running sum
+// of pixels, computed for a whole vector with shifts and adds
+// (a prefix sum). Average and Paeth depend on the previous pixel
+// in a way that can't be summed, so they go a pixel at a time,
+// but all the channels of a pixel at once. Only 3 and 4 byte
+// pixels (RGB and RGBA) have vector kernels; other sizes and the
+// ends of rows use the scalar code.
+//
+// Converting unfiltered rows to and from 32 bit pixels is a byte
+// shuffle: each RGBA pixel is byteswapped and each RGB pixel gets
+// an alpha byte. pshufb does either for a whole vector at once.
+
+#include <string.h>
+#include "pnglite_simd.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PNG_SIMD_X86 1
+#else
+#define PNG_SIMD_X86 0
+#endif
+
+// Unfilters the start of a row with one filter type, returning
+// how many bytes were done; the scalar code does the rest.
+typedef size_t (*UnfilterFn)(unsigned bpp, const unsigned char *in,
+                             const unsigned char *prev, unsigned char *out, size_t len);
+
+// Converts the start of a row of pixels, returning how many
+// pixels were done; the scalar code does the rest.
+typedef size_t (*ToPixelsFn)(const unsigned char *in, uint32_t *out, size_t n);
+typedef size_t (*FromPixelsFn)(const uint32_t *in, unsigned char *out, size_t n);
+
+struct PngSimdImpl {
+  const char *name;
+  uint64_t (*filter_row)(int type, unsigned bpp, const unsigned char *row,
+                         const unsigned char *prev, unsigned char *out, size_t len);
+  UnfilterFn unfilter[5];  // indexed by filter type, NULL for none
+  ToPixelsFn rgb_to_pixels;
+  ToPixelsFn rgba_to_pixels;
+  FromPixelsFn pixels_to_rgba;
+};
+
+////////////////////////////////////////////////////////////////////////
+// Scalar implementation
+////////////////////////////////////////////////////////////////////////
+
+//
+// Paeth predictor, as in the PNG specification.
+//
+static inline unsigned paeth_predict(unsigned a, unsigned b, unsigned c) {
+  int p = (int) a + (int) b - (int) c;
+  int pa = p > (int) a ? p - (int) a : (int) a - p;
+  int pb = p > (int) b ? p - (int) b : (int) b - p;
+  int pc = p > (int) c ? p - (int) c : (int) c - p;
+
+  if (pa <= pb && pa <= pc) {
+    return a;
+  } else if (pb <= pc) {
+    return b;
+  } else {
+    return c;
+  }
+}
+
+//
+// Absolute value of a filtered byte taken as signed.
+//
+static inline unsigned filter_cost(unsigned char v) {
+  return v < 128 ? v : 256 - v;
+}
+
+// filters bytes start..end-1 of a row, PREDICT being an
+// expression of a, b, and c
+#define SCALAR_FILTER_LOOP(PREDICT)                               \
+  for (size_t i = start; i < end; i++) {                          \
+    unsigned a = i >= bpp ? row[i - bpp] : 0;                     \
+    unsigned b = prev[i];                                         \
+    unsigned c = i >= bpp ? prev[i - bpp] : 0;                    \
+    (void) a; (void) b; (void) c;                                 \
+    out[i] = (unsigned char) (row[i] - (PREDICT));                \
+    sum += filter_cost(out[i]);                                   \
+  }
+
+//
+// Filters bytes start..end-1 of a row. Used for whole rows, and
+// for the ends of rows that don't fill a vector.
+//
+static uint64_t filter_range_scalar(int type, unsigned bpp, const unsigned char *row,
+                                    const unsigned char *prev, unsigned char *out,
+                                    size_t start, size_t end) {
+  uint64_t sum = 0;
+
+  switch (type) {
+  case PNG_FILTER_SUB:
+    SCALAR_FILTER_LOOP(a);
+    break;
+  case PNG_FILTER_UP:
+    SCALAR_FILTER_LOOP(b);
+    break;
+  case PNG_FILTER_AVERAGE:
+    SCALAR_FILTER_LOOP((a + b) >> 1);
+    break;
+  case PNG_FILTER_PAETH:
+    SCALAR_FILTER_LOOP(paeth_predict(a, b, c));
+    break;
+  default:
+    SCALAR_FILTER_LOOP(0);
+    break;
+  }
+
+  return sum;
+}
+
+static uint64_t filter_row_scalar(int type, unsigned bpp, const unsigned char *row,
+                                  const unsigned char *prev, unsigned char *out, size_t len) {
+  return filter_range_scalar(type, bpp, row, prev, out, 0, len);
+}
+
+// unfilters bytes start..end-1 of a row, PREDICT being an
+// expression of a, b, and c
+#define SCALAR_UNFILTER_LOOP(PREDICT)                             \
+  for (size_t i = start; i < end; i++) {                          \
+    unsigned a = i >= bpp ? out[i - bpp] : 0;                     \
+    unsigned b = prev != NULL ? prev[i] : 0;                      \
+    unsigned c = i >= bpp && prev != NULL ? prev[i - bpp] : 0;    \
+    (void) a; (void) b; (void) c;                                 \
+    out[i] = (unsigned char) (in[i] + (PREDICT));                 \
+  }
+
+//
+// Unfilters bytes start..end-1 of a row, the ones before start
+// having been unfiltered already.
+//
+static void unfilter_range_scalar(int type, unsigned bpp, const unsigned char *in,
+                                  const unsigned char *prev, unsigned char *out,
+                                  size_t start, size_t end) {
+  switch (type) {
+  case PNG_FILTER_SUB:
+    SCALAR_UNFILTER_LOOP(a);
+    break;
+  case PNG_FILTER_UP:
+    SCALAR_UNFILTER_LOOP(b);
+    break;
+  case PNG_FILTER_AVERAGE:
+    SCALAR_UNFILTER_LOOP((a + b) >> 1);
+    break;
+  case PNG_FILTER_PAETH:
+    SCALAR_UNFILTER_LOOP(paeth_predict(a, b, c));
+    break;
+  default:
+    if (in != out) {
+      memcpy(out + start, in + start, end - start);
+    }
+    break;
+  }
+}
+
+// Pixel conversions, byte by byte so that they don't depend on
+// the byte order of the system.
+
+static void rgb_to_pixels_scalar(const unsigned char *in, uint32_t *out, size_t start, size_t n) {
+  for (size_t i = start; i < n; i++) {
+    const unsigned char *p = in + i * 3;
+    out[i] = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | 0xFF;
+  }
+}
+
+static void rgba_to_pixels_scalar(const unsigned char *in, uint32_t *out, size_t start, size_t n) {
+  for (size_t i = start; i < n; i++) {
+    const unsigned char *p = in + i * 4;
+    out[i] = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+  }
+}
+
+static void pixels_to_rgba_scalar(const uint32_t *in, unsigned char *out, size_t start, size_t n) {
+  for (size_t i = start; i < n; i++) {
+    unsigned char *p = out + i * 4;
+    p[0] = (unsigned char) (in[i] >> 24);
+    p[1] = (unsigned char) (in[i] >> 16);
+    p[2] = (unsigned char) (in[i] >> 8);
+    p[3] = (unsigned char) in[i];
+  }
+}
+
+#if PNG_SIMD_X86
+
+// every x86 CPU is little-endian, which the pixel kernels rely on
+_Static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "pixel kernels need little-endian pixels");
+
+////////////////////////////////////////////////////////////////////////
+// SSE2 implementation (16 bytes per iteration)
+////////////////////////////////////////////////////////////////////////
+
+//
+// Picks a, b, or c in each 16 bit lane given the distances pa,
+// pb, and pc, with the tie breaking of the PNG specification.
+//
+__attribute__((target("sse2")))
+static inline __m128i paeth_select_epi16_sse2(__m128i a, __m128i b, __m128i c,
+                                              __m128i pa, __m128i pb, __m128i pc) {
+  __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+  __m128i not_b = _mm_cmpgt_epi16(pb, pc);
+  __m128i b_or_c = _mm_or_si128(_mm_andnot_si128(not_b, b), _mm_and_si128(not_b, c));
+  return _mm_or_si128(_mm_andnot_si128(not_a, a), _mm_and_si128(not_a, b_or_c));
+}
+
+//
+// Paeth predictor for 8 bytes widened to 16 bit lanes.
+//
+__attribute__((target("sse2")))
+static inline __m128i paeth_epi16_sse2(__m128i a, __m128i b, __m128i c) {
+  // with p = a + b - c: |p - a| = |b - c|, |p - b| = |a - c|,
+  // and |p - c| = |(b - c) + (a - c)|
+  __m128i zero = _mm_setzero_si128();
+  __m128i bc = _mm_sub_epi16(b, c);
+  __m128i ac = _mm_sub_epi16(a, c);
+  __m128i sum = _mm_add_epi16(bc, ac);
+  __m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+  __m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+  __m128i pc = _mm_max_epi16(sum, _mm_sub_epi16(zero, sum));
+  return paeth_select_epi16_sse2(a, b, c, pa, pb, pc);
+}
+
+//
+// Paeth predictor for 16 bytes.
+//
+__attribute__((target("sse2")))
+static inline __m128i paeth_sse2(__m128i a, __m128i b, __m128i c) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = paeth_epi16_sse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                _mm_unpacklo_epi8(c, zero));
+  __m128i hi = paeth_epi16_sse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                _mm_unpackhi_epi8(c, zero));
+  return _mm_packus_epi16(lo, hi);
+}
+
+//
+// Average predictor (a + b) >> 1 for 16 bytes. _mm_avg_epu8
+// rounds up, so subtract the bit it rounded.
+//
+__attribute__((target("sse2")))
+static inline __m128i average_sse2(__m128i a, __m128i b) {
+  __m128i round = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+  return _mm_sub_epi8(_mm_avg_epu8(a, b), round);
+}
+
+// filters whole vectors from i on, PREDICT being an expression
+// of the vectors a, b, and c
+#define SSE2_FILTER_LOOP(PREDICT)                                         \
+  for (; i + 16 <= len; i += 16) {                                        \
+    __m128i x = _mm_loadu_si128((const __m128i *) (row + i));             \
+    __m128i a = _mm_loadu_si128((const __m128i *) (row + i - bpp));       \
+    __m128i b = _mm_loadu_si128((const __m128i *) (prev + i));            \
+    __m128i c = _mm_loadu_si128((const __m128i *) (prev + i - bpp));      \
+    (void) a; (void) b; (void) c;                                         \
+    __m128i f = _mm_sub_epi8(x, (PREDICT));                               \
+    _mm_storeu_si128((__m128i *) (out + i), f);                           \
+    __m128i cost = _mm_min_epu8(f, _mm_sub_epi8(zero, f));                \
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(cost, zero));                   \
+  }
+
+__attribute__((target("sse2")))
+static uint64_t filter_row_sse2(int type, unsigned bpp, const unsigned char *row,
+                                const unsigned char *prev, unsigned char *out, size_t len) {
+  // the first pixel has no left neighbours
+  size_t i = bpp < len ? bpp : len;
+  uint64_t sum = filter_range_scalar(type, bpp, row, prev, out, 0, i);
+
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+
+  switch (type) {
+  case PNG_FILTER_SUB:
+    SSE2_FILTER_LOOP(a);
+    break;
+  case PNG_FILTER_UP:
+    SSE2_FILTER_LOOP(b);
+    break;
+  case PNG_FILTER_AVERAGE:
+    SSE2_FILTER_LOOP(average_sse2(a, b));
+    break;
+  case PNG_FILTER_PAETH:
+    SSE2_FILTER_LOOP(paeth_sse2(a, b, c));
+    break;
+  default:
+    SSE2_FILTER_LOOP(zero);
+    break;
+  }
+
+  sum += (uint64_t) _mm_cvtsi128_si64(acc) + (uint64_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+  return sum + filter_range_scalar(type, bpp, row, prev, out, i, len);
+}
+
+//
+// Loads a pixel into the low lanes of a vector. This always
+// reads 4 bytes; for 3 byte pixels the extra lane is garbage,
+// but the lanes never mix and it is never stored.
+//
+__attribute__((target("sse2"), always_inline))
+static inline __m128i load_pixel_sse2(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return _mm_cvtsi32_si128((int) v);
+}
+
+//
+// Stores the low 3 or 4 lanes of a vector as a pixel.
+//
+__attribute__((target("sse2"), always_inline))
+static inline void store_pixel_sse2(unsigned char *p, __m128i v, unsigned bpp) {
+  uint32_t x = (uint32_t) _mm_cvtsi128_si32(v);
+  memcpy(p, &x, bpp);
+}
+
+__attribute__((target("sse2")))
+static size_t unfilter_sub_sse2(unsigned bpp, const unsigned char *in,
+                                const unsigned char *prev, unsigned char *out, size_t len) {
+  (void) prev;
+  size_t i = 0;
+  // a holds the last unfiltered pixel in its low lanes, and
+  // adding it to the first pixel carries it through the prefix sum
+  __m128i a = _mm_setzero_si128();
+
+  if (bpp == 4) {
+    for (; i + 16 <= len; i += 16) {
+      __m128i x = _mm_add_epi8(_mm_loadu_si128((const __m128i *) (in + i)), a);
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      _mm_storeu_si128((__m128i *) (out + i), x);
+      a = _mm_srli_si128(x, 12);
+    }
+  } else if (bpp == 3) {
+    // 4 pixels per vector; the last 4 lanes are left alone, since
+    // when unfiltering in place they are input not yet read
+    __m128i mask = _mm_cvtsi32_si128(0xFFFFFF);
+    for (; i + 16 <= len; i += 12) {
+      __m128i x = _mm_add_epi8(_mm_loadu_si128((const __m128i *) (in + i)), a);
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+      _mm_storel_epi64((__m128i *) (out + i), x);
+      store_pixel_sse2(out + i + 8, _mm_srli_si128(x, 8), 4);
+      a = _mm_and_si128(_mm_srli_si128(x, 9), mask);
+    }
+  }
+  return i;
+}
+
+__attribute__((target("sse2")))
+static size_t unfilter_up_sse2(unsigned bpp, const unsigned char *in,
+                               const unsigned char *prev, unsigned char *out, size_t len) {
+  (void) bpp;
+  size_t i = 0;
+  if (prev == NULL) {
+    return 0;
+  }
+  for (; i + 16 <= len; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+    __m128i b = _mm_loadu_si128((const __m128i *) (prev + i));
+    _mm_storeu_si128((__m128i *) (out + i), _mm_add_epi8(x, b));
+  }
+  return i;
+}
+
+//
+// Unfilters Average a pixel at a time. Inlined with a constant
+// bpp, so the pixel loads and stores are plain moves.
+//
+__attribute__((target("sse2"), always_inline))
+static inline size_t unfilter_average_pixels_sse2(unsigned bpp, const unsigned char *in,
+                                                  const unsigned char *prev, unsigned char *out,
+                                                  size_t len) {
+  size_t i = 0;
+  // the left neighbour of the first pixel is 0
+  __m128i a = _mm_setzero_si128();
+  for (; i + 4 <= len; i += bpp) {
+    __m128i b = load_pixel_sse2(prev + i);
+    a = _mm_add_epi8(load_pixel_sse2(in + i), average_sse2(a, b));
+    store_pixel_sse2(out + i, a, bpp);
+  }
+  return i;
+}
+
+__attribute__((target("sse2")))
+static size_t unfilter_average_sse2(unsigned bpp, const unsigned char *in,
+                                    const unsigned char *prev, unsigned char *out, size_t len) {
+  if (prev == NULL) {
+    return 0;
+  } else if (bpp == 4) {
+    return unfilter_average_pixels_sse2(4, in, prev, out, len);
+  } else if (bpp == 3) {
+    return unfilter_average_pixels_sse2(3, in, prev, out, len);
+  }
+  return 0;
+}
+
+// unfilters Paeth a pixel at a time, PAETH_EPI16 being the
+// predictor on 16 bit lanes; BPP must be the constant 3 or 4 so
+// the pixel loads and stores are plain moves
+#define UNFILTER_PAETH_LOOP(PAETH_EPI16, BPP)                             \
+  do {                                                                    \
+    __m128i zero = _mm_setzero_si128();                                   \
+    __m128i a = zero, c = zero;                                           \
+    for (; i + 4 <= len; i += (BPP)) {                                    \
+      __m128i b = _mm_unpacklo_epi8(load_pixel_sse2(prev + i), zero);     \
+      __m128i p = PAETH_EPI16(a, b, c);                                   \
+      __m128i x = _mm_unpacklo_epi8(load_pixel_sse2(in + i), zero);       \
+      a = _mm_and_si128(_mm_add_epi16(x, p), _mm_set1_epi16(0xFF));       \
+      store_pixel_sse2(out + i, _mm_packus_epi16(a, a), (BPP));           \
+      c = b;                                                              \
+    }                                                                     \
+  } while (0)
+
+__attribute__((target("sse2")))
+static size_t unfilter_paeth_sse2(unsigned bpp, const unsigned char *in,
+                                  const unsigned char *prev, unsigned char *out, size_t len) {
+  size_t i = 0;
+  if (prev == NULL) {
+    return 0;
+  } else if (bpp == 4) {
+    UNFILTER_PAETH_LOOP(paeth_epi16_sse2, 4);
+  } else if (bpp == 3) {
+    UNFILTER_PAETH_LOOP(paeth_epi16_sse2, 3);
+  }
+  return i;
+}
+
+//
+// Reverses the bytes of each 32 bit lane, without pshufb: swap
+// the 16 bit halves, then the bytes of each half.
+//
+__attribute__((target("sse2")))
+static inline __m128i bswap_epi32_sse2(__m128i x) {
+  x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+  return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+__attribute__((target("sse2")))
+static size_t rgba_to_pixels_sse2(const unsigned char *in, uint32_t *out, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (in + i * 4));
+    _mm_storeu_si128((__m128i *) (out + i), bswap_epi32_sse2(x));
+  }
+  return i;
+}
+
+__attribute__((target("sse2")))
+static size_t pixels_to_rgba_sse2(const uint32_t *in, unsigned char *out, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+    _mm_storeu_si128((__m128i *) (out + i * 4), bswap_epi32_sse2(x));
+  }
+  return i;
+}
+
+////////////////////////////////////////////////////////////////////////
+// SSSE3 implementation (SSE2 plus a cheaper Paeth predictor and
+// pshufb for the pixel conversions)
+////////////////////////////////////////////////////////////////////////
+
+// pshufb masks: reverse each pixel, and spread 4 RGB pixels out
+// to ABGR order in memory with a zero alpha byte (0x80 selects 0)
+#define BSWAP_MASK 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+#define RGB_MASK (char) 0x80, 2, 1, 0, (char) 0x80, 5, 4, 3, (char) 0x80, 8, 7, 6, (char) 0x80, 11, 10, 9
+
+//
+// Paeth predictor for 8 bytes widened to 16 bit lanes, using
+// pabsw for the distances.
+//
+__attribute__((target("ssse3")))
+static inline __m128i paeth_epi16_ssse3(__m128i a, __m128i b, __m128i c) {
+  __m128i bc = _mm_sub_epi16(b, c);
+  __m128i ac = _mm_sub_epi16(a, c);
+  __m128i pa = _mm_abs_epi16(bc);
+  __m128i pb = _mm_abs_epi16(ac);
+  __m128i pc = _mm_abs_epi16(_mm_add_epi16(bc, ac));
+  return paeth_select_epi16_sse2(a, b, c, pa, pb, pc);
+}
+
+__attribute__((target("ssse3")))
+static size_t unfilter_paeth_ssse3(unsigned bpp, const unsigned char *in,
+                                   const unsigned char *prev, unsigned char *out, size_t len) {
+  size_t i = 0;
+  if (prev == NULL) {
+    return 0;
+  } else if (bpp == 4) {
+    UNFILTER_PAETH_LOOP(paeth_epi16_ssse3, 4);
+  } else if (bpp == 3) {
+    UNFILTER_PAETH_LOOP(paeth_epi16_ssse3, 3);
+  }
+  return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t rgb_to_pixels_ssse3(const unsigned char *in, uint32_t *out, size_t n) {
+  const __m128i mask = _mm_setr_epi8(RGB_MASK);
+  const __m128i alpha = _mm_set1_epi32(0xFF);
+  size_t i = 0;
+  // each 16 byte load uses 12 bytes, so it must not be one of the
+  // last 5 pixels
+  for (; i + 6 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (in + i * 3));
+    _mm_storeu_si128((__m128i *) (out + i), _mm_or_si128(_mm_shuffle_epi8(x, mask), alpha));
+  }
+  return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t rgba_to_pixels_ssse3(const unsigned char *in, uint32_t *out, size_t n) {
+  const __m128i mask = _mm_setr_epi8(BSWAP_MASK);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (in + i * 4));
+    _mm_storeu_si128((__m128i *) (out + i), _mm_shuffle_epi8(x, mask));
+  }
+  return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t pixels_to_rgba_ssse3(const uint32_t *in, unsigned char *out, size_t n) {
+  const __m128i mask = _mm_setr_epi8(BSWAP_MASK);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+    _mm_storeu_si128((__m128i *) (out + i * 4), _mm_shuffle_epi8(x, mask));
+  }
+  return i;
+}
+
+////////////////////////////////////////////////////////////////////////
+// AVX2 implementation (32 bytes per iteration for Sub, Up, and the
+// pixel conversions)
+////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static size_t unfilter_sub_avx2(unsigned bpp, const unsigned char *in,
+                                const unsigned char *prev, unsigned char *out, size_t len) {
+  if (bpp != 4) {
+    return unfilter_sub_sse2(bpp, in, prev, out, len);
+  }
+
+  size_t i = 0;
+  // a holds the last unfiltered pixel in all 8 pixels
+  __m256i a = _mm256_setzero_si256();
+  __m256i last = _mm256_set1_epi32(7);
+  for (; i + 32 <= len; i += 32) {
+    // prefix sums of each 128 bit half, then the last pixel of
+    // the low half is added to every pixel of the high half
+    __m256i x = _mm256_loadu_si256((const __m256i *) (in + i));
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 8));
+    __m256i carry = _mm256_shuffle_epi32(x, 0xFF);
+    x = _mm256_add_epi8(x, _mm256_permute2x128_si256(carry, carry, 0x08));
+    x = _mm256_add_epi8(x, a);
+    _mm256_storeu_si256((__m256i *) (out + i), x);
+    a = _mm256_permutevar8x32_epi32(x, last);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t unfilter_up_avx2(unsigned bpp, const unsigned char *in,
+                               const unsigned char *prev, unsigned char *out, size_t len) {
+  (void) bpp;
+  size_t i = 0;
+  if (prev == NULL) {
+    return 0;
+  }
+  for (; i + 32 <= len; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (in + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (prev + i));
+    _mm256_storeu_si256((__m256i *) (out + i), _mm256_add_epi8(x, b));
+  }
+  return i + unfilter_up_sse2(bpp, in + i, prev + i, out + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t rgb_to_pixels_avx2(const unsigned char *in, uint32_t *out, size_t n) {
+  // vpshufb only shuffles within 128 bit halves, so each half is
+  // loaded with its own 4 pixels
+  const __m256i mask = _mm256_setr_epi8(RGB_MASK, RGB_MASK);
+  const __m256i alpha = _mm256_set1_epi32(0xFF);
+  size_t i = 0;
+  for (; i + 10 <= n; i += 8) {
+    __m128i lo = _mm_loadu_si128((const __m128i *) (in + i * 3));
+    __m128i hi = _mm_loadu_si128((const __m128i *) (in + i * 3 + 12));
+    __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    _mm256_storeu_si256((__m256i *) (out + i), _mm256_or_si256(_mm256_shuffle_epi8(x, mask), alpha));
+  }
+  return i + rgb_to_pixels_ssse3(in + i * 3, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t rgba_to_pixels_avx2(const unsigned char *in, uint32_t *out, size_t n) {
+  const __m256i mask = _mm256_setr_epi8(BSWAP_MASK, BSWAP_MASK);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (in + i * 4));
+    _mm256_storeu_si256((__m256i *) (out + i), _mm256_shuffle_epi8(x, mask));
+  }
+  return i + rgba_to_pixels_ssse3(in + i * 4, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t pixels_to_rgba_avx2(const uint32_t *in, unsigned char *out, size_t n) {
+  const __m256i mask = _mm256_setr_epi8(BSWAP_MASK, BSWAP_MASK);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (in + i));
+    _mm256_storeu_si256((__m256i *) (out + i * 4), _mm256_shuffle_epi8(x, mask));
+  }
+  return i + pixels_to_rgba_ssse3(in + i, out + i * 4, n - i);
+}
+
+#endif // PNG_SIMD_X86
+
+////////////////////////////////////////////////////////////////////////
+// Runtime dispatch
+////////////////////////////////////////////////////////////////////////
+
+static const struct PngSimdImpl impls[] = {
+#if PNG_SIMD_X86
+  { "avx2", filter_row_sse2,
+    { NULL, unfilter_sub_avx2, unfilter_up_avx2, unfilter_average_sse2, unfilter_paeth_ssse3 },
+    rgb_to_pixels_avx2, rgba_to_pixels_avx2, pixels_to_rgba_avx2 },
+  { "ssse3", filter_row_sse2,
+    { NULL, unfilter_sub_sse2, unfilter_up_sse2, unfilter_average_sse2, unfilter_paeth_ssse3 },
+    rgb_to_pixels_ssse3, rgba_to_pixels_ssse3, pixels_to_rgba_ssse3 },
+  { "sse2", filter_row_sse2,
+    { NULL, unfilter_sub_sse2, unfilter_up_sse2, unfilter_average_sse2, unfilter_paeth_sse2 },
+    NULL, rgba_to_pixels_sse2, pixels_to_rgba_sse2 },
+#endif
+  { "scalar", filter_row_scalar, { NULL, NULL, NULL, NULL, NULL }, NULL, NULL, NULL },
+};
+
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static const struct PngSimdImpl *current_impl = &impls[NUM_IMPLS - 1];
+
+//
+// Checks whether the CPU can run the named implementation.
+//
+static int impl_supported(const char *name) {
+#if PNG_SIMD_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2");
+  }
+  if (strcmp(name, "ssse3") == 0) {
+    return __builtin_cpu_supports("ssse3");
+  }
+  if (strcmp(name, "sse2") == 0) {
+    return __builtin_cpu_supports("sse2");
+  }
+#endif
+  return strcmp(name, "scalar") == 0;
+}
+
+//
+// Picks the fastest supported implementation at program startup.
+//
+__attribute__((constructor))
+static void png_simd_init(void) {
+  for (unsigned i = 0; i < NUM_IMPLS; i++) {
+    if (impl_supported(impls[i].name)) {
+      current_impl = &impls[i];
+      return;
+    }
+  }
+}
+
+int png_simd_select(const char *name) {
+  for (unsigned i = 0; i < NUM_IMPLS; i++) {
+    if (strcmp(impls[i].name, name) == 0 && impl_supported(name)) {
+      current_impl = &impls[i];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+const char *png_simd_impl(void) {
+  return current_impl->name;
+}
+
+uint64_t png_filter_row(int type, unsigned bpp, const unsigned char *row,
+                        const unsigned char *prev, unsigned char *out, size_t len) {
+  return current_impl->filter_row(type, bpp, row, prev, out, len);
+}
+
+void png_unfilter_row(int type, unsigned bpp, const unsigned char *in,
+                      const unsigned char *prev, unsigned char *out, size_t len) {
+  size_t done = 0;
+  if (type >= 0 && type <= PNG_FILTER_PAETH && current_impl->unfilter[type] != NULL) {
+    done = current_impl->unfilter[type](bpp, in, prev, out, len);
+  }
+  unfilter_range_scalar(type, bpp, in, prev, out, done, len);
+}
+
+void png_rgb_to_pixels(const unsigned char *in, uint32_t *out, size_t n) {
+  size_t done = current_impl->rgb_to_pixels != NULL ? current_impl->rgb_to_pixels(in, out, n) : 0;
+  rgb_to_pixels_scalar(in, out, done, n);
+}
+
+void png_rgba_to_pixels(const unsigned char *in, uint32_t *out, size_t n) {
+  size_t done = current_impl->rgba_to_pixels != NULL ? current_impl->rgba_to_pixels(in, out, n) : 0;
+  rgba_to_pixels_scalar(in, out, done, n);
+}
+
+void png_pixels_to_rgba(const uint32_t *in, unsigned char *out, size_t n) {
+  size_t done = current_impl->pixels_to_rgba != NULL ? current_impl->pixels_to_rgba(in, out, n) : 0;
+  pixels_to_rgba_scalar(in, out, done, n);
+}
@@ -0,0 +1,101 @@
+/*
+ * SIMD kernels for PNG row filters
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef PNGLITE_SIMD_H
+#define PNGLITE_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// PNG filter types
+#define PNG_FILTER_NONE     0
+#define PNG_FILTER_SUB      1
+#define PNG_FILTER_UP       2
+#define PNG_FILTER_AVERAGE  3
+#define PNG_FILTER_PAETH    4
+
+// Filter one row of an image for writing, and score the result
+// with the minimum-sum-of-absolute-differences heuristic (the
+// filtered bytes are taken as signed, so smaller sums usually
+// compress better).
+//
+// Parameters:
+//   type - one of the PNG_FILTER_* values
+//   bpp - bytes per pixel
+//   row - the row to filter
+//   prev - the row above it (all zeros for the first row)
+//   out - receives the len filtered bytes
+//   len - number of bytes in the row
+//
+// Returns:
+//   sum of the absolute values of the filtered bytes
+uint64_t png_filter_row(int type, unsigned bpp, const unsigned char *row,
+                        const unsigned char *prev, unsigned char *out, size_t len);
+
+// Undo the filter of one row of an image being read. Rows with
+// 3 or 4 bytes per pixel (RGB and RGBA) use the vector kernels;
+// the result is the same for every implementation.
+//
+// Parameters:
+//   type - one of the PNG_FILTER_* values
+//   bpp - bytes per pixel
+//   in - the filtered row
+//   prev - the unfiltered row above it, or NULL for the first row
+//   out - receives the len unfiltered bytes (may be the same as in)
+//   len - number of bytes in the row
+void png_unfilter_row(int type, unsigned bpp, const unsigned char *in,
+                      const unsigned char *prev, unsigned char *out, size_t len);
+
+// Convert a row of RGB pixels (3 bytes each, as stored in a PNG
+// file) to 32 bit pixels, with R in the most significant byte and
+// an opaque alpha in the least significant byte.
+//
+// Parameters:
+//   in - the 3*n bytes of the row
+//   out - receives the n pixels
+//   n - number of pixels
+void png_rgb_to_pixels(const unsigned char *in, uint32_t *out, size_t n);
+
+// Convert a row of RGBA pixels (4 bytes each, as stored in a PNG
+// file) to 32 bit pixels, with R in the most significant byte and
+// A in the least significant byte. On a little-endian system this
+// is a byteswap of each pixel.
+//
+// Parameters:
+//   in - the 4*n bytes of the row
+//   out - receives the n pixels
+//   n - number of pixels
+void png_rgba_to_pixels(const unsigned char *in, uint32_t *out, size_t n);
+
+// Convert a row of 32 bit pixels to RGBA bytes for a PNG file;
+// the inverse of png_rgba_to_pixels.
+//
+// Parameters:
+//   in - the n pixels
+//   out - receives the 4*n bytes of the row
+//   n - number of pixels
+void png_pixels_to_rgba(const uint32_t *in, unsigned char *out, size_t n);
+
+// Select the implementation used by the PNG filter and pixel
+// conversion kernels.
+// By default the fastest one supported by the CPU is chosen
+// ("avx2", then "ssse3", "sse2", and "scalar").
+//
+// Parameters:
+//   name - one of "avx2", "ssse3", "sse2", or "scalar"
+//
+// Returns:
+//   1 if the implementation was selected, 0 if it is unknown or
+//   not supported on this CPU
+int png_simd_select(const char *name);
+
+// Returns:
+//   the name of the PNG filter implementation currently in use
+const char *png_simd_impl(void);
+
+#endif // PNGLITE_SIMD_H
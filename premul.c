@@ -0,0 +1,134 @@
+/*
+ * Premultiplied-alpha sprite sheets
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "premul.h"
+#include "clip.h"
+
+//
+// Divides by 255, exact for 0 <= x <= 255*255 (see blend_span.c).
+//
+static inline uint32_t div255(uint32_t x) {
+  return (x + 1 + (x >> 8)) >> 8;
+}
+
+//
+// Converts a straight-alpha color to a premultiplied pixel.
+//
+static uint64_t premultiply(uint32_t color) {
+  uint64_t alpha = color & 0xFF;
+  uint64_t r = ((color >> 24) & 0xFF) * alpha;
+  uint64_t g = ((color >> 16) & 0xFF) * alpha;
+  uint64_t b = ((color >> 8) & 0xFF) * alpha;
+  return (r << 48) | (g << 32) | (b << 16) | alpha;
+}
+
+//
+// Blends a run of premultiplied pixels over a run of destination pixels.
+// Identical to blend_colors on the straight-alpha source colors.
+//
+// Parameters:
+//   dst - pointer to the first destination pixel
+//   src - pointer to the first premultiplied source pixel
+//   n   - number of pixels in the run
+//
+static void blend_premul_span(uint32_t *dst, const uint64_t *src, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t fg = src[i];
+    uint32_t bg = dst[i];
+    uint32_t inv_alpha = 255 - (uint32_t) (fg & 0xFF);
+
+    uint32_t r = div255((uint32_t) (fg >> 48) + ((bg >> 24) & 0xFF) * inv_alpha);
+    uint32_t g = div255((uint32_t) ((fg >> 32) & 0xFFFF) + ((bg >> 16) & 0xFF) * inv_alpha);
+    uint32_t b = div255((uint32_t) ((fg >> 16) & 0xFFFF) + ((bg >> 8) & 0xFF) * inv_alpha);
+
+    dst[i] = (r << 24) | (g << 16) | (b << 8) | 0xFF;
+  }
+}
+
+int premultiply_image(struct PremulImage *out, const struct Image *img) {
+  uint32_t num_pixels = img->width * img->height;
+
+  out->data = (uint64_t *) malloc(num_pixels * sizeof(uint64_t));
+  if (out->data == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  if (build_opacity_index(&out->runs, img) != IMG_SUCCESS) {
+    free(out->data);
+    out->data = NULL;
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  for (uint32_t i = 0; i < num_pixels; i++) {
+    out->data[i] = premultiply(img->data[i]);
+  }
+
+  out->width = img->width;
+  out->height = img->height;
+  out->source = img;
+  return IMG_SUCCESS;
+}
+
+void free_premul_image(struct PremulImage *img) {
+  free(img->data);
+  free_opacity_index(&img->runs);
+  img->data = NULL;
+  img->source = NULL;
+}
+
+void draw_sprite_premul(struct Image *img,
+                        int32_t x, int32_t y,
+                        const struct PremulImage *spritemap,
+                        const struct Rect *sprite) {
+
+  // same bounds rules as draw_sprite
+  if (!rect_in_bounds(spritemap->source, sprite)) {
+    return;
+  }
+
+  struct Rect dest = { .x = x, .y = y, .width = sprite->width, .height = sprite->height };
+  struct Rect clipped;
+  if (!clip_rect(img, &dest, &clipped)) {
+    return;
+  }
+
+  // part of the sprite sheet that actually lands on the image
+  uint32_t src_x_start = sprite->x + (clipped.x - x);
+  uint32_t src_x_end = src_x_start + clipped.width;
+  uint32_t src_y = sprite->y + (clipped.y - y);
+
+  for (int32_t row = 0; row < clipped.height; row++, src_y++) {
+    uint32_t *dst_row = img->data + (clipped.y + row) * img->width + clipped.x;
+    const uint64_t *premul_row = spritemap->data + src_y * spritemap->width;
+    const uint32_t *straight_row = spritemap->source->data + src_y * spritemap->width;
+
+    // walk the runs that overlap the visible columns
+    uint32_t run = find_opacity_run(&spritemap->runs, src_y, src_x_start);
+    uint32_t col = src_x_start;
+    while (col < src_x_end) {
+      const struct OpacityRun *r = &spritemap->runs.runs[run++];
+      uint32_t run_end = r->x + r->length < src_x_end ? r->x + r->length : src_x_end;
+      uint32_t *dst = dst_row + (col - src_x_start);
+
+      if (r->kind == OPACITY_OPAQUE) {
+        memcpy(dst, straight_row + col, (run_end - col) * sizeof(uint32_t));
+      } else if (r->kind == OPACITY_TRANSPARENT) {
+        // background survives, but blending always makes it opaque
+        for (uint32_t i = 0; i < run_end - col; i++) {
+          dst[i] |= 0xFF;
+        }
+      } else {
+        blend_premul_span(dst, premul_row + col, run_end - col);
+      }
+      col = run_end;
+    }
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ * Premultiplied-alpha sprite sheets
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef PREMUL_H
+#define PREMUL_H
+
+#include <stdint.h>
+#include "image.h"
+#include "drawing_funcs.h"
+#include "opacity.h"
+
+// A sprite sheet converted to premultiplied alpha.
+// Each pixel is 64 bits: alpha*r, alpha*g, alpha*b, and alpha,
+// 16 bits each (from most to least significant). Keeping the
+// full 16 bit products means blending needs only one multiply
+// per channel and still gives exactly the blend_colors result.
+struct PremulImage {
+  uint32_t width;
+  uint32_t height;
+  uint64_t *data;
+  struct OpacityIndex runs;    // transparent/opaque/partial runs of each row
+  const struct Image *source;  // straight-alpha pixels, copied for opaque runs
+};
+
+// Convert a sprite sheet to premultiplied alpha.
+// The source image is not copied, so it must stay alive (and
+// unmodified) for as long as the premultiplied sheet is used.
+//
+// Parameters:
+//   out - pointer to PremulImage to initialize
+//   img - pointer to the straight-alpha sprite sheet
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+int premultiply_image(struct PremulImage *out, const struct Image *img);
+
+// Free the memory owned by a premultiplied sprite sheet
+// (but not its source image).
+//
+// Parameters:
+//   img - pointer to PremulImage to free
+void free_premul_image(struct PremulImage *img);
+
+// Draw a sprite from a premultiplied sprite sheet.
+// The result is identical to draw_sprite with the source sheet.
+//
+// Parameters:
+//   img - pointer to Image (dest image)
+//   x - x coordinate of location where sprite should be copied
+//   y - y coordinate of location where sprite should be copied
+//   spritemap - pointer to PremulImage (the spritemap)
+//   sprite - pointer to Rect (the sprite)
+void draw_sprite_premul(struct Image *img,
+                        int32_t x, int32_t y,
+                        const struct PremulImage *spritemap,
+                        const struct Rect *sprite);
+
+#endif // PREMUL_H
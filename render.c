@@ -0,0 +1,220 @@
+/*
+ * Band-parallel rendering of parsed drawing commands
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "render.h"
+#include "parallel.h"
+#include "clip.h"
+
+// bands per thread, so a thread that finishes early can take
+// another band instead of waiting on the busiest one
+#define BANDS_PER_THREAD 4
+
+// everything a band worker needs
+struct BandJob {
+  struct Image *img;
+  const struct DisplayList *dl;
+  uint32_t num_bands;
+};
+
+// commands binned by tile, stored like an OpacityIndex: the
+// commands of tile t are cmds[tile_start[t]] up to (not including)
+// cmds[tile_start[t + 1]], in recorded order
+struct TileBins {
+  uint32_t cols, rows;
+  uint32_t *tile_start;
+  uint32_t *cmds;
+  uint32_t *active;      // tiles with at least one command
+  uint32_t num_active;
+};
+
+// everything a tile worker needs
+struct TileJob {
+  struct Image *img;
+  const struct DisplayList *dl;
+  const struct TileBins *bins;
+};
+
+//
+// Finds the range of tiles (columns tx_start..tx_end-1 and rows
+// ty_start..ty_end-1) that a command's bounds touch on an image.
+//
+// Returns:
+//   1 if the command touches at least one tile, 0 otherwise
+//
+static int32_t command_tiles(const struct Image *img, const struct DrawCommand *cmd,
+                             uint32_t *tx_start, uint32_t *ty_start,
+                             uint32_t *tx_end, uint32_t *ty_end) {
+  struct Rect visible;
+  if (cmd->bounds.width <= 0 || cmd->bounds.height <= 0 ||
+      !clip_rect(img, &cmd->bounds, &visible)) {
+    return 0;
+  }
+  *tx_start = visible.x / RENDER_TILE_SIZE;
+  *ty_start = visible.y / RENDER_TILE_SIZE;
+  *tx_end = (visible.x + visible.width - 1) / RENDER_TILE_SIZE + 1;
+  *ty_end = (visible.y + visible.height - 1) / RENDER_TILE_SIZE + 1;
+  return 1;
+}
+
+//
+// Bins the commands of a display list by the tiles they touch.
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+//
+static int bin_commands(struct TileBins *bins, const struct Image *img, const struct DisplayList *dl) {
+  bins->cols = (img->width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  bins->rows = (img->height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  uint64_t num_tiles = (uint64_t) bins->cols * bins->rows;
+
+  bins->tile_start = (uint32_t *) calloc(num_tiles + 1, sizeof(uint32_t));
+  bins->active = (uint32_t *) malloc(num_tiles * sizeof(uint32_t) + 1);
+  bins->cmds = NULL;
+  if (bins->tile_start == NULL || bins->active == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  // first pass: count the commands of each tile
+  uint32_t tx_start, ty_start, tx_end, ty_end;
+  for (uint32_t i = 0; i < dl->count; i++) {
+    if (command_tiles(img, &dl->cmds[i], &tx_start, &ty_start, &tx_end, &ty_end)) {
+      for (uint32_t ty = ty_start; ty < ty_end; ty++) {
+        for (uint32_t tx = tx_start; tx < tx_end; tx++) {
+          bins->tile_start[ty * bins->cols + tx + 1]++;
+        }
+      }
+    }
+  }
+
+  // prefix sums give where each tile's commands start
+  uint64_t total = 0;
+  bins->num_active = 0;
+  for (uint64_t t = 0; t < num_tiles; t++) {
+    if (bins->tile_start[t + 1] != 0) {
+      bins->active[bins->num_active++] = (uint32_t) t;
+    }
+    total += bins->tile_start[t + 1];
+    if (total > UINT32_MAX) {
+      return IMG_ERR_MALLOC_FAILED;
+    }
+    bins->tile_start[t + 1] = (uint32_t) total;
+  }
+
+  bins->cmds = (uint32_t *) malloc(total * sizeof(uint32_t) + 1);
+  uint32_t *fill = (uint32_t *) malloc(num_tiles * sizeof(uint32_t) + 1);
+  if (bins->cmds == NULL || fill == NULL) {
+    free(fill);
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  memcpy(fill, bins->tile_start, num_tiles * sizeof(uint32_t));
+
+  // second pass: store the commands in recorded order
+  for (uint32_t i = 0; i < dl->count; i++) {
+    if (command_tiles(img, &dl->cmds[i], &tx_start, &ty_start, &tx_end, &ty_end)) {
+      for (uint32_t ty = ty_start; ty < ty_end; ty++) {
+        for (uint32_t tx = tx_start; tx < tx_end; tx++) {
+          bins->cmds[fill[ty * bins->cols + tx]++] = i;
+        }
+      }
+    }
+  }
+
+  free(fill);
+  return IMG_SUCCESS;
+}
+
+//
+// Frees the memory owned by a TileBins.
+//
+static void free_bins(struct TileBins *bins) {
+  free(bins->tile_start);
+  free(bins->cmds);
+  free(bins->active);
+}
+
+//
+// Renders one active tile through a scratch buffer.
+//
+static void render_tile(void *arg, uint32_t index) {
+  struct TileJob *job = (struct TileJob *) arg;
+  const struct TileBins *bins = job->bins;
+  struct Image *img = job->img;
+  uint32_t tile = bins->active[index];
+
+  uint32_t x0 = (tile % bins->cols) * RENDER_TILE_SIZE;
+  uint32_t y0 = (tile / bins->cols) * RENDER_TILE_SIZE;
+  uint32_t width = img->width - x0 < RENDER_TILE_SIZE ? img->width - x0 : RENDER_TILE_SIZE;
+  uint32_t height = img->height - y0 < RENDER_TILE_SIZE ? img->height - y0 : RENDER_TILE_SIZE;
+
+  uint32_t pixels[RENDER_TILE_SIZE * RENDER_TILE_SIZE];
+  struct Image scratch = { .width = width, .height = height, .data = pixels, .opacity = NULL };
+
+  for (uint32_t y = 0; y < height; y++) {
+    memcpy(pixels + y * width, img->data + (uint64_t) (y0 + y) * img->width + x0, width * sizeof(uint32_t));
+  }
+
+  for (uint32_t i = bins->tile_start[tile]; i < bins->tile_start[tile + 1]; i++) {
+    replay_command(&scratch, &job->dl->cmds[bins->cmds[i]], (int32_t) x0, (int32_t) y0);
+  }
+
+  for (uint32_t y = 0; y < height; y++) {
+    memcpy(img->data + (uint64_t) (y0 + y) * img->width + x0, pixels + y * width, width * sizeof(uint32_t));
+  }
+}
+
+//
+// Replays every command on one band of the image.
+//
+static void render_band(void *arg, uint32_t band) {
+  struct BandJob *job = (struct BandJob *) arg;
+  uint32_t height = job->img->height;
+  uint32_t y_start = (uint32_t) ((uint64_t) height * band / job->num_bands);
+  uint32_t y_end = (uint32_t) ((uint64_t) height * (band + 1) / job->num_bands);
+
+  // the band looks like a whole image to the drawing functions,
+  // so they do the clipping and the list is just replayed at an offset
+  struct Image view = {
+    .width = job->img->width,
+    .height = y_end - y_start,
+    .data = job->img->data + (uint64_t) y_start * job->img->width,
+    .opacity = NULL,
+  };
+
+  replay_display_list(&view, job->dl, 0, (int32_t) y_start);
+}
+
+void render_bands(struct Image *img, const struct DisplayList *dl, uint32_t num_threads) {
+  struct BandJob job = { .img = img, .dl = dl, .num_bands = 1 };
+
+  if (num_threads > 1) {
+    uint64_t num_bands = (uint64_t) num_threads * BANDS_PER_THREAD;
+    job.num_bands = num_bands < img->height ? (uint32_t) num_bands : img->height;
+  }
+  if (job.num_bands == 0) {
+    return;
+  }
+
+  parallel_for(job.num_bands, num_threads, render_band, &job);
+}
+
+int render_tiles(struct Image *img, const struct DisplayList *dl, uint32_t num_threads) {
+  struct TileBins bins;
+  if (bin_commands(&bins, img, dl) != IMG_SUCCESS) {
+    free_bins(&bins);
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  struct TileJob job = { .img = img, .dl = dl, .bins = &bins };
+  parallel_for(bins.num_active, num_threads, render_tile, &job);
+
+  free_bins(&bins);
+  return IMG_SUCCESS;
+}
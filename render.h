@@ -0,0 +1,51 @@
+/*
+ * Band-parallel rendering of parsed drawing commands
+ * CSF Assignment 2
+ * Atticus Colwell
+ * acolwel2@jhu.edu
+ * Matthew Blackburn
+ * mblackb8@jhu.edu
+ */
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdint.h>
+#include "image.h"
+#include "display_list.h"
+
+// Replay a display list onto an image (whose top left pixel is
+// the recorded point (0, 0)). The image is split into horizontal
+// bands and every band replays the whole list, clipped
+// to its own rows, on one of up to num_threads threads. Bands
+// never share a pixel, so the result is identical to drawing
+// the commands one after the other on a single thread.
+//
+// Parameters:
+//   img - pointer to Image (dest image)
+//   dl - pointer to the DisplayList to replay
+//   num_threads - maximum number of threads to use
+void render_bands(struct Image *img, const struct DisplayList *dl, uint32_t num_threads);
+
+// width and height of the tiles used by render_tiles
+#define RENDER_TILE_SIZE 64
+
+// Replay a display list onto an image (whose top left pixel is
+// the recorded point (0, 0)), one small tile at a time. Every
+// command is first binned into the tiles its bounds touch; then
+// each tile that has commands is copied into a scratch buffer
+// small enough to stay in cache, has its commands replayed, and
+// is copied back, on one of up to num_threads threads. Tiles
+// that no command touches are left as they are. The result is
+// identical to drawing the commands one after the other.
+//
+// Parameters:
+//   img - pointer to Image (dest image)
+//   dl - pointer to the DisplayList to replay
+//   num_threads - maximum number of threads to use
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise IMG_ERR_MALLOC_FAILED
+//   (in which case the image is unchanged)
+int render_tiles(struct Image *img, const struct DisplayList *dl, uint32_t num_threads);
+
+#endif // RENDER_H
@@ -2,8 +2,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <zlib.h>
 #include "image.h"
 #include "drawing_funcs.h"
+#include "blend_span.h"
+#include "premul.h"
+#include "opacity.h"
+#include "display_list.h"
+#include "render.h"
+#include "cull.h"
+#include "image_cache.h"
+#include "pnglite.h"
+#include "pnglite_simd.h"
+#include "pnglite_crc.h"
 #include "tctest.h"
 
 // an expected color identified by a (non-zero) character code
@@ -78,10 +90,13 @@ void check_picture(struct Image *img, Picture *p) {
 // prototypes of test functions
 void test_draw_pixel(TestObjs *objs);
 void test_draw_rect(TestObjs *objs);
+void test_draw_rect_clip(TestObjs *objs);
 void test_draw_circle(TestObjs *objs);
 void test_draw_circle_clip(TestObjs *objs);
-//void test_draw_tile(TestObjs *objs);
-//void test_draw_sprite(TestObjs *objs);
+void test_draw_circle_matches_pixels(TestObjs *objs);
+void test_draw_tile(TestObjs *objs);
+void test_draw_sprite(TestObjs *objs);
+void test_draw_sprite_indexed(TestObjs *objs);
 void test_color_extraction(TestObjs *objs);
 void test_compute_index(TestObjs *objs);
 void test_in_bounds(TestObjs *objs);
@@ -90,6 +105,26 @@ void test_blend_colors();
 void test_square_dist();
 void test_square();
 void test_set_pixel();
+void test_blend_span();
+void test_draw_sprite_premul(TestObjs *objs);
+void test_opacity_index(TestObjs *objs);
+void test_display_list(TestObjs *objs);
+void test_render_bands(TestObjs *objs);
+void test_render_tiles(TestObjs *objs);
+void test_cull_occluded(TestObjs *objs);
+void test_write_image_rows(TestObjs *objs);
+void test_read_image_streaming(TestObjs *objs);
+void test_png_filter_row(TestObjs *objs);
+void test_png_filter_modes(TestObjs *objs);
+void test_png_unfilter_row(TestObjs *objs);
+void test_write_image_ex(TestObjs *objs);
+void test_write_image_threads(TestObjs *objs);
+void test_read_image_threads(TestObjs *objs);
+void test_png_pixel_conversions(TestObjs *objs);
+void test_png_open_mem_read(TestObjs *objs);
+void test_png_crc32(TestObjs *objs);
+void test_image_cache(TestObjs *objs);
+void test_rgba_image(TestObjs *objs);
 
 int main(int argc, char **argv) {
   if (argc > 1) {
@@ -101,10 +136,13 @@ int main(int argc, char **argv) {
 
   TEST(test_draw_pixel);
   TEST(test_draw_rect);
+  TEST(test_draw_rect_clip);
   TEST(test_draw_circle);
   TEST(test_draw_circle_clip);
-  //TEST(test_draw_tile);
-  //TEST(test_draw_sprite);
+  TEST(test_draw_circle_matches_pixels);
+  TEST(test_draw_tile);
+  TEST(test_draw_sprite);
+  TEST(test_draw_sprite_indexed);
   TEST(test_color_extraction);
   TEST(test_compute_index);
   TEST(test_in_bounds);
@@ -113,6 +151,26 @@ int main(int argc, char **argv) {
   TEST(test_square_dist);
   TEST(test_square); 
   TEST(test_set_pixel);
+  TEST(test_blend_span);
+  TEST(test_draw_sprite_premul);
+  TEST(test_opacity_index);
+  TEST(test_display_list);
+  TEST(test_render_bands);
+  TEST(test_render_tiles);
+  TEST(test_cull_occluded);
+  TEST(test_write_image_rows);
+  TEST(test_read_image_streaming);
+  TEST(test_png_filter_row);
+  TEST(test_png_filter_modes);
+  TEST(test_png_unfilter_row);
+  TEST(test_write_image_ex);
+  TEST(test_write_image_threads);
+  TEST(test_read_image_threads);
+  TEST(test_png_pixel_conversions);
+  TEST(test_png_open_mem_read);
+  TEST(test_png_crc32);
+  TEST(test_image_cache);
+  TEST(test_rgba_image);
   TEST_FINI();
 }
 
@@ -324,6 +382,34 @@ void test_draw_rect(TestObjs *objs) {
   check_picture(&objs->small, &expected);
 }
 
+void test_draw_rect_clip(TestObjs *objs) {
+  // hangs off the top left and right edges of the image
+  struct Rect wide_rect = { .x = -3, .y = -2, .width = 20, .height = 4 };
+  // entirely outside of the image
+  struct Rect off_rect = { .x = 8, .y = 0, .width = 5, .height = 5 };
+  // fully transparent, should leave the background alone
+  struct Rect clear_rect = { .x = 0, .y = 0, .width = 8, .height = 6 };
+  // empty
+  struct Rect empty_rect = { .x = 1, .y = 3, .width = 0, .height = 2 };
+
+  draw_rect(&objs->small, &wide_rect, 0x00FF00FF);
+  draw_rect(&objs->small, &off_rect, 0xFF0000FF);
+  draw_rect(&objs->small, &clear_rect, 0xFFFFFF00);
+  draw_rect(&objs->small, &empty_rect, 0xFF0000FF);
+
+  Picture expected = {
+    { {'g', 0x00FF00FF}, {' ', 0x000000FF} },
+    "gggggggg"
+    "gggggggg"
+    "        "
+    "        "
+    "        "
+    "        "
+  };
+
+  check_picture(&objs->small, &expected);
+}
+
 void test_draw_circle(TestObjs *objs) {
   Picture expected = {
     { {' ', 0x000000FF}, {'x', 0x00FF00FF} },
@@ -356,6 +442,35 @@ void test_draw_circle_clip(TestObjs *objs) {
   check_picture(&objs->small, &expected);
 }
 
+void test_draw_circle_matches_pixels(TestObjs *objs) {
+  struct Image expected;
+  init_image(&expected, LARGE_W, LARGE_H);
+
+  // centers inside, near the edges, and entirely off of the image
+  const int32_t centers[][2] = { {11, 9}, {0, 0}, {23, 19}, {-4, 10}, {30, -3}, {12, 40} };
+  for (unsigned c = 0; c < sizeof(centers) / sizeof(centers[0]); c++) {
+    for (int32_t r = -1; r <= 25; r += 2) {
+      int32_t x = centers[c][0], y = centers[c][1];
+      uint32_t color = 0x20406000U | (r * 9 & 0xFF);
+
+      draw_circle(&objs->large, x, y, r, color);
+
+      // reference: test and draw every pixel of the bounding square
+      for (int32_t i = y - r; i <= y + r; i++) {
+        for (int32_t j = x - r; j <= x + r; j++) {
+          if (square_dist(x, y, j, i) <= (int64_t) r * r) {
+            draw_pixel(&expected, j, i, color);
+          }
+        }
+      }
+
+      ASSERT(memcmp(objs->large.data, expected.data, LARGE_W * LARGE_H * sizeof(uint32_t)) == 0);
+    }
+  }
+
+  free(expected.data);
+}
+
 void test_draw_tile(TestObjs *objs) {
   ASSERT(read_image("img/PrtMimi.png", &objs->tilemap) == IMG_SUCCESS);
 
@@ -442,3 +557,984 @@ void test_draw_sprite(TestObjs *objs) {
   check_picture(&objs->large, &pic);
 } 
 
+void test_blend_span() {
+  const char *impls[] = { "scalar", "sse2", "avx2" };
+  uint32_t src[19], dst[19], expected[19];
+
+  for (unsigned k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+    if (!blend_span_select(impls[k])) {
+      continue; // not supported on this machine
+    }
+
+    for (uint32_t alpha = 0; alpha < 256; alpha++) {
+      // odd length so that the vector loops also leave a tail
+      for (uint32_t i = 0; i < 19; i++) {
+        src[i] = (0x9E3779B1U * (alpha + i)) & 0xFFFFFF00U;
+        src[i] |= (i % 3 == 0) ? alpha : (alpha * 7 + i) & 0xFF;
+        dst[i] = 0x85EBCA77U * (alpha * 19 + i);
+      }
+
+      // single color over a run
+      uint32_t color = (src[1] & 0xFFFFFF00U) | alpha;
+      for (uint32_t i = 0; i < 19; i++) {
+        expected[i] = blend_colors(color, dst[i]);
+      }
+      uint32_t actual[19];
+      memcpy(actual, dst, sizeof(actual));
+      blend_span(actual, color, 19);
+      ASSERT(memcmp(actual, expected, sizeof(actual)) == 0);
+
+      // run of source pixels over a run
+      for (uint32_t i = 0; i < 19; i++) {
+        expected[i] = blend_colors(src[i], dst[i]);
+      }
+      blend_span_src(dst, src, 19);
+      ASSERT(memcmp(dst, expected, sizeof(dst)) == 0);
+    }
+  }
+
+  ASSERT(blend_span_select("scalar"));
+  ASSERT(!blend_span_select("no such implementation"));
+  ASSERT(strcmp(blend_span_impl(), "scalar") == 0);
+}
+
+void test_draw_sprite_premul(TestObjs *objs) {
+  ASSERT(read_image("img/NpcGuest.png", &objs->spritemap) == IMG_SUCCESS);
+
+  struct PremulImage premul;
+  ASSERT(premultiply_image(&premul, &objs->spritemap) == IMG_SUCCESS);
+
+  struct Image expected;
+  init_image(&expected, LARGE_W, LARGE_H);
+
+  // on the image, clipped on each side, and an invalid source rect
+  const int32_t positions[][2] = { {4, 2}, {-5, 3}, {15, -6}, {20, 12}, {40, 0} };
+  const struct Rect sprites[] = {
+    { .x = 128, .y = 136, .width = 16, .height = 15 },
+    { .x = 0, .y = 0, .width = 24, .height = 20 },
+    { .x = 200, .y = 180, .width = 16, .height = 16 },
+  };
+
+  for (unsigned s = 0; s < sizeof(sprites) / sizeof(sprites[0]); s++) {
+    for (unsigned p = 0; p < sizeof(positions) / sizeof(positions[0]); p++) {
+      int32_t x = positions[p][0], y = positions[p][1];
+      const struct Rect *r = &sprites[s];
+
+      // reference: blend every pixel with set_pixel
+      if (r->x + r->width <= (int32_t) objs->spritemap.width && r->y + r->height <= (int32_t) objs->spritemap.height) {
+        for (int32_t i = 0; i < r->height; i++) {
+          for (int32_t j = 0; j < r->width; j++) {
+            if (in_bounds(&expected, x + j, y + i)) {
+              uint32_t color = objs->spritemap.data[compute_index(&objs->spritemap, r->x + j, r->y + i)];
+              set_pixel(&expected, compute_index(&expected, x + j, y + i), color);
+            }
+          }
+        }
+      }
+
+      draw_sprite_premul(&objs->large, x, y, &premul, r);
+      ASSERT(memcmp(objs->large.data, expected.data, LARGE_W * LARGE_H * sizeof(uint32_t)) == 0);
+    }
+  }
+
+  free(expected.data);
+  free_premul_image(&premul);
+}
+
+void test_opacity_index(TestObjs *objs) {
+  // 0 = transparent, 1 = opaque, 2 = partial
+  struct Image img;
+  init_image(&img, 6, 3);
+  uint32_t alphas[] = {
+    0x00, 0x00, 0xFF, 0xFF, 0x80, 0x00,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x01, 0xFE, 0x00, 0x80, 0x80, 0xFF,
+  };
+  for (unsigned i = 0; i < 18; i++) {
+    img.data[i] = 0x12345600U | alphas[i];
+  }
+
+  ASSERT(attach_opacity_index(&img) == IMG_SUCCESS);
+  struct OpacityIndex *index = img.opacity;
+  ASSERT(index != NULL);
+  ASSERT(index->height == 3);
+
+  // row 0: T T | O O | P | T
+  ASSERT(index->row_start[0] == 0 && index->row_start[1] == 4);
+  ASSERT(index->runs[0].x == 0 && index->runs[0].length == 2 && index->runs[0].kind == OPACITY_TRANSPARENT);
+  ASSERT(index->runs[1].x == 2 && index->runs[1].length == 2 && index->runs[1].kind == OPACITY_OPAQUE);
+  ASSERT(index->runs[2].x == 4 && index->runs[2].length == 1 && index->runs[2].kind == OPACITY_PARTIAL);
+  ASSERT(index->runs[3].x == 5 && index->runs[3].length == 1 && index->runs[3].kind == OPACITY_TRANSPARENT);
+
+  // row 1: a single opaque run
+  ASSERT(index->row_start[2] == 5);
+  ASSERT(index->runs[4].x == 0 && index->runs[4].length == 6 && index->runs[4].kind == OPACITY_OPAQUE);
+
+  // row 2: P P | T | P P | O
+  ASSERT(index->row_start[3] == 9);
+  ASSERT(index->runs[5].length == 2 && index->runs[5].kind == OPACITY_PARTIAL);
+  ASSERT(index->runs[6].x == 2 && index->runs[6].kind == OPACITY_TRANSPARENT);
+  ASSERT(index->runs[7].x == 3 && index->runs[7].length == 2 && index->runs[7].kind == OPACITY_PARTIAL);
+  ASSERT(index->runs[8].x == 5 && index->runs[8].kind == OPACITY_OPAQUE);
+
+  // lookups land on the run containing the column
+  ASSERT(find_opacity_run(index, 0, 0) == 0);
+  ASSERT(find_opacity_run(index, 0, 3) == 1);
+  ASSERT(find_opacity_run(index, 0, 5) == 3);
+  ASSERT(find_opacity_run(index, 1, 4) == 4);
+  ASSERT(find_opacity_run(index, 2, 4) == 7);
+
+  detach_opacity_index(&img);
+  ASSERT(img.opacity == NULL);
+  free(img.data);
+}
+
+void test_draw_sprite_indexed(TestObjs *objs) {
+  // same picture as test_draw_sprite, but through the opacity index
+  ASSERT(read_image("img/NpcGuest.png", &objs->spritemap) == IMG_SUCCESS);
+  ASSERT(attach_opacity_index(&objs->spritemap) == IMG_SUCCESS);
+
+  struct Image expected;
+  init_image(&expected, LARGE_W, LARGE_H);
+  struct Image plain = objs->spritemap;
+  plain.opacity = NULL;
+
+  const int32_t positions[][2] = { {4, 2}, {-7, 1}, {12, -9}, {19, 15} };
+  struct Rect sue = { .x = 128, .y = 136, .width = 16, .height = 15 };
+  for (unsigned p = 0; p < sizeof(positions) / sizeof(positions[0]); p++) {
+    draw_sprite(&expected, positions[p][0], positions[p][1], &plain, &sue);
+    draw_sprite(&objs->large, positions[p][0], positions[p][1], &objs->spritemap, &sue);
+    ASSERT(memcmp(objs->large.data, expected.data, LARGE_W * LARGE_H * sizeof(uint32_t)) == 0);
+  }
+
+  detach_opacity_index(&objs->spritemap);
+  free(expected.data);
+}
+
+//
+// Records the scene used by the display list and renderer tests:
+// commands that straddle band edges and the image edges.
+//
+void record_test_scene(TestObjs *objs, struct DisplayList *dl) {
+  struct Rect rect1 = { -3, 2, 20, 11 };
+  struct Rect tile = { 32, 32, 16, 16 };
+  struct Rect sprite = { 128, 136, 16, 15 };
+  struct Rect rect2 = { 5, 0, 9, LARGE_H };
+
+  init_display_list(dl);
+  ASSERT(record_rect(dl, &rect1, 0x1a0249ffU) == IMG_SUCCESS);
+  ASSERT(record_circle(dl, 12, 9, 8, 0x7602d180U) == IMG_SUCCESS);
+  ASSERT(record_tile(dl, 15, -4, &objs->tilemap, &tile) == IMG_SUCCESS);
+  ASSERT(record_sprite(dl, 3, 11, &objs->spritemap, &sprite) == IMG_SUCCESS);
+  ASSERT(record_rect(dl, &rect2, 0xffffff40U) == IMG_SUCCESS);
+  ASSERT(record_circle(dl, 0, LARGE_H, 6, 0x00ff00c0U) == IMG_SUCCESS);
+}
+
+//
+// Draws the scene of record_test_scene directly.
+//
+void draw_test_scene(TestObjs *objs, struct Image *img) {
+  struct Rect rect1 = { -3, 2, 20, 11 };
+  struct Rect tile = { 32, 32, 16, 16 };
+  struct Rect sprite = { 128, 136, 16, 15 };
+  struct Rect rect2 = { 5, 0, 9, LARGE_H };
+
+  draw_rect(img, &rect1, 0x1a0249ffU);
+  draw_circle(img, 12, 9, 8, 0x7602d180U);
+  draw_tile(img, 15, -4, &objs->tilemap, &tile);
+  draw_sprite(img, 3, 11, &objs->spritemap, &sprite);
+  draw_rect(img, &rect2, 0xffffff40U);
+  draw_circle(img, 0, LARGE_H, 6, 0x00ff00c0U);
+}
+
+//
+// Counts the IDAT chunks of a PNG file (0 if it can't be opened).
+//
+unsigned count_idats(const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  unsigned num_idats = 0;
+  char window[4] = { 0, 0, 0, 0 };
+  int c;
+  while ((c = fgetc(f)) != EOF) {
+    memmove(window, window + 1, 3);
+    window[3] = (char) c;
+    num_idats += memcmp(window, "IDAT", 4) == 0;
+  }
+  fclose(f);
+  return num_idats;
+}
+
+void test_display_list(TestObjs *objs) {
+  ASSERT(read_image("img/PrtMimi.png", &objs->tilemap) == IMG_SUCCESS);
+  ASSERT(read_image("img/NpcGuest.png", &objs->spritemap) == IMG_SUCCESS);
+
+  struct DisplayList dl;
+  record_test_scene(objs, &dl);
+  ASSERT(dl.count == 6);
+
+  // bounds of each kind of command
+  ASSERT(dl.cmds[0].bounds.x == -3 && dl.cmds[0].bounds.y == 2);
+  ASSERT(dl.cmds[0].bounds.width == 20 && dl.cmds[0].bounds.height == 11);
+  ASSERT(dl.cmds[1].bounds.x == 4 && dl.cmds[1].bounds.y == 1);
+  ASSERT(dl.cmds[1].bounds.width == 17 && dl.cmds[1].bounds.height == 17);
+  ASSERT(dl.cmds[2].bounds.x == 15 && dl.cmds[2].bounds.y == -4);
+  ASSERT(dl.cmds[2].bounds.width == 16 && dl.cmds[2].bounds.height == 16);
+  ASSERT(dl.bounds.x == -6 && dl.bounds.y == -4);
+  ASSERT(dl.bounds.width == 37 && dl.bounds.height == LARGE_H + 11);
+
+  // commands that can never draw anything have empty bounds
+  struct Rect outside = { 1000, 1000, 16, 16 };
+  ASSERT(record_sprite(&dl, 0, 0, &objs->spritemap, &outside) == IMG_SUCCESS);
+  ASSERT(record_circle(&dl, 5, 5, -1, 0xffffffffU) == IMG_SUCCESS);
+  ASSERT(dl.cmds[6].bounds.width == 0 && dl.cmds[7].bounds.width == 0);
+  ASSERT(dl.bounds.width == 37 && dl.bounds.height == LARGE_H + 11);
+
+  // replaying draws the same image as drawing directly
+  struct Image expected;
+  init_image(&expected, LARGE_W, LARGE_H);
+  draw_test_scene(objs, &expected);
+  replay_display_list(&objs->large, &dl, 0, 0);
+  ASSERT(memcmp(objs->large.data, expected.data, LARGE_W * LARGE_H * sizeof(uint32_t)) == 0);
+
+  // a window of the scene onto a smaller canvas matches the same
+  // window of the full image
+  struct Image window;
+  init_image(&window, SMALL_W, SMALL_H);
+  replay_display_list(&window, &dl, 9, 11);
+  for (uint32_t y = 0; y < SMALL_H; y++) {
+    ASSERT(memcmp(window.data + y * SMALL_W, expected.data + (y + 11) * LARGE_W + 9,
+                  SMALL_W * sizeof(uint32_t)) == 0);
+  }
+
+  // replaying again is the same as drawing everything twice
+  draw_test_scene(objs, &expected);
+  replay_display_list(&objs->large, &dl, 0, 0);
+  ASSERT(memcmp(objs->large.data, expected.data, LARGE_W * LARGE_H * sizeof(uint32_t)) == 0);
+
+  free_display_list(&dl);
+  ASSERT(dl.count == 0 && dl.cmds == NULL);
+  free(window.data);
+  free(expected.data);
+}
+
+void test_render_bands(TestObjs *objs) {
+  ASSERT(read_image("img/PrtMimi.png", &objs->tilemap) == IMG_SUCCESS);
+  ASSERT(read_image("img/NpcGuest.png", &objs->spritemap) == IMG_SUCCESS);
+
+  struct DisplayList dl;
+  record_test_scene(objs, &dl);
+
+  struct Image expected;
+  init_image(&expected, LARGE_W, LARGE_H);
+  draw_test_scene(objs, &expected);
+
+  // any number of threads (and so bands) gives the same image,
+  // including more bands than rows
+  const uint32_t thread_counts[] = { 1, 2, 3, 7, 64 };
+  for (unsigned t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+    struct Image actual;
+    init_image(&actual, LARGE_W, LARGE_H);
+    render_bands(&actual, &dl, thread_counts[t]);
+    ASSERT(memcmp(actual.data, expected.data, LARGE_W * LARGE_H * sizeof(uint32_t)) == 0);
+    free(actual.data);
+  }
+
+  free_display_list(&dl);
+  free(expected.data);
+}
+
+void test_render_tiles(TestObjs *objs) {
+  ASSERT(read_image("img/PrtMimi.png", &objs->tilemap) == IMG_SUCCESS);
+  ASSERT(read_image("img/NpcGuest.png", &objs->spritemap) == IMG_SUCCESS);
+
+  // a canvas that is several tiles across, with partial edge tiles
+  const uint32_t w = 3 * RENDER_TILE_SIZE + 5, h = 2 * RENDER_TILE_SIZE + 17;
+  struct DisplayList dl;
+  init_display_list(&dl);
+  for (int32_t i = 0; i < 40; i++) {
+    struct Rect rect = { i * 13 - 20, i * 7 - 10, 30 + i, 9 + i % 5 };
+    struct Rect tile = { 32 + (i % 4) * 16, 32, 16, 16 };
+    struct Rect sprite = { 128, 136, 16, 15 };
+    ASSERT(record_rect(&dl, &rect, 0x10203000U | (i * 6)) == IMG_SUCCESS);
+    ASSERT(record_circle(&dl, (int32_t) w - i * 9, i * 5, 3 + i, 0x7602d180U) == IMG_SUCCESS);
+    ASSERT(record_tile(&dl, i * 11 - 8, (int32_t) h - i * 6, &objs->tilemap, &tile) == IMG_SUCCESS);
+    ASSERT(record_sprite(&dl, i * 17 % w, i * 3, &objs->spritemap, &sprite) == IMG_SUCCESS);
+  }
+
+  struct Image expected;
+  init_image(&expected, w, h);
+  replay_display_list(&expected, &dl, 0, 0);
+
+  const uint32_t thread_counts[] = { 1, 3 };
+  for (unsigned t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+    struct Image actual;
+    init_image(&actual, w, h);
+    ASSERT(render_tiles(&actual, &dl, thread_counts[t]) == IMG_SUCCESS);
+    ASSERT(memcmp(actual.data, expected.data, w * h * sizeof(uint32_t)) == 0);
+    free(actual.data);
+  }
+
+  // tiles no command touches are never written
+  struct DisplayList corner;
+  init_display_list(&corner);
+  struct Rect rect = { 0, 0, 10, 10 };
+  ASSERT(record_rect(&corner, &rect, 0xffffffffU) == IMG_SUCCESS);
+  struct Image canvas;
+  init_image(&canvas, w, h);
+  canvas.data[w * h - 1] = 0x12345678U;
+  ASSERT(render_tiles(&canvas, &corner, 2) == IMG_SUCCESS);
+  ASSERT(canvas.data[0] == 0xffffffffU);
+  ASSERT(canvas.data[w * h - 1] == 0x12345678U);
+
+  free(canvas.data);
+  free_display_list(&corner);
+  free_display_list(&dl);
+  free(expected.data);
+}
+
+void test_cull_occluded(TestObjs *objs) {
+  ASSERT(read_image("img/PrtMimi.png", &objs->tilemap) == IMG_SUCCESS);
+
+  struct Rect tile = { 32, 32, 16, 16 };
+  struct Rect bad_tile = { 1000, 32, 16, 16 };
+  struct Rect small = { 2, 3, 5, 4 };
+  struct Rect cover = { 0, 0, LARGE_W, 10 };
+  struct Rect offscreen = { -20, 0, 10, 10 };
+
+  struct DisplayList dl;
+  init_display_list(&dl);
+  ASSERT(record_tile(&dl, 4, 2, &objs->tilemap, &tile) == IMG_SUCCESS);        // repainted by #2
+  ASSERT(record_rect(&dl, &small, 0x102030ffU) == IMG_SUCCESS);                // covered by #5
+  ASSERT(record_tile(&dl, 4, 2, &objs->tilemap, &tile) == IMG_SUCCESS);        // sticks out below #5
+  ASSERT(record_circle(&dl, 6, 6, 2, 0xff000080U) == IMG_SUCCESS);             // any kind is hidden by #5
+  ASSERT(record_rect(&dl, &offscreen, 0xffffffffU) == IMG_SUCCESS);            // off the canvas
+  ASSERT(record_rect(&dl, &cover, 0x406080ffU) == IMG_SUCCESS);                // opaque occluder
+  ASSERT(record_tile(&dl, 0, 0, &objs->tilemap, &bad_tile) == IMG_SUCCESS);    // draws nothing
+  ASSERT(record_rect(&dl, &cover, 0x40608080U) == IMG_SUCCESS);                // blended, occludes nothing
+
+  struct Image expected;
+  init_image(&expected, LARGE_W, LARGE_H);
+  replay_display_list(&expected, &dl, 0, 0);
+
+  struct CullStats stats;
+  ASSERT(cull_occluded(&dl, &objs->large, &stats) == IMG_SUCCESS);
+  ASSERT(stats.culled_commands == 3);
+  ASSERT(stats.culled_pixels == 16 * 16 + 5 * 4 + 5 * 5);
+  ASSERT(stats.offscreen_commands == 2);
+  ASSERT(dl.count == 3);
+  ASSERT(dl.cmds[0].kind == 'T' && dl.cmds[1].kind == 'R' && dl.cmds[2].kind == 'R');
+
+  // culling never changes the image
+  replay_display_list(&objs->large, &dl, 0, 0);
+  ASSERT(memcmp(objs->large.data, expected.data, LARGE_W * LARGE_H * sizeof(uint32_t)) == 0);
+
+  free_display_list(&dl);
+  free(expected.data);
+}
+
+void test_write_image_rows(TestObjs *objs) {
+  // noise compresses badly, so the file needs several IDAT chunks
+  const uint32_t w = 300, h = 257;
+  struct Image img;
+  init_image(&img, w, h);
+  uint32_t seed = 12345;
+  for (uint32_t i = 0; i < w * h; i++) {
+    seed = seed * 1103515245U + 12345U;
+    img.data[i] = seed ^ (seed >> 16);
+  }
+
+  // rows written in uneven groups
+  struct ImageWriter *writer;
+  ASSERT(begin_write_image(&writer, "test_write_image_rows.png", w, h) == IMG_SUCCESS);
+  uint32_t y = 0, group = 1;
+  while (y < h) {
+    uint32_t n = group < h - y ? group : h - y;
+    ASSERT(write_image_rows(writer, img.data + y * w, n) == IMG_SUCCESS);
+    y += n;
+    group = group * 3 % 17 + 1;
+  }
+  ASSERT(finish_write_image(writer) == IMG_SUCCESS);
+
+  struct Image loaded;
+  ASSERT(read_image("test_write_image_rows.png", &loaded) == IMG_SUCCESS);
+  ASSERT(loaded.width == w && loaded.height == h);
+  ASSERT(memcmp(loaded.data, img.data, w * h * sizeof(uint32_t)) == 0);
+  free(loaded.data);
+
+  ASSERT(count_idats("test_write_image_rows.png") > 1);
+
+  // finishing early is an error
+  ASSERT(begin_write_image(&writer, "test_write_image_rows.png", w, h) == IMG_SUCCESS);
+  ASSERT(write_image_rows(writer, img.data, 10) == IMG_SUCCESS);
+  ASSERT(finish_write_image(writer) != IMG_SUCCESS);
+
+  remove("test_write_image_rows.png");
+  free(img.data);
+}
+
+void test_read_image_streaming(TestObjs *objs) {
+  // a sprite sheet written out and decoded again row by row
+  // comes back unchanged
+  ASSERT(read_image("img/NpcGuest_lg.png", &objs->spritemap) == IMG_SUCCESS);
+  ASSERT(write_image("test_read_image_streaming.png", &objs->spritemap) == IMG_SUCCESS);
+  struct Image copy;
+  ASSERT(read_image("test_read_image_streaming.png", &copy) == IMG_SUCCESS);
+  ASSERT(copy.width == objs->spritemap.width && copy.height == objs->spritemap.height);
+  ASSERT(memcmp(copy.data, objs->spritemap.data, copy.width * copy.height * sizeof(uint32_t)) == 0);
+  free(copy.data);
+
+  // a file cut off in the middle of its image data is an error
+  FILE *f = fopen("test_read_image_streaming.png", "rb");
+  ASSERT(f != NULL);
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  ASSERT(truncate("test_read_image_streaming.png", size / 2) == 0);
+  ASSERT(read_image("test_read_image_streaming.png", &copy) != IMG_SUCCESS);
+
+  remove("test_read_image_streaming.png");
+}
+
+void test_png_filter_row(TestObjs *objs) {
+  // every implementation filters exactly like the scalar one,
+  // for every pixel size and lengths around the vector width
+  unsigned char row[80], prev[80], expected[80], actual[80];
+  uint32_t seed = 777;
+  for (unsigned i = 0; i < sizeof(row); i++) {
+    seed = seed * 1103515245U + 12345U;
+    row[i] = (unsigned char) (seed >> 16);
+    prev[i] = (unsigned char) (seed >> 24);
+  }
+
+  const char *impl = png_simd_impl();
+  for (int type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++) {
+    for (unsigned bpp = 1; bpp <= 8; bpp++) {
+      for (size_t len = bpp; len <= sizeof(row); len += 7) {
+        ASSERT(png_simd_select("scalar"));
+        uint64_t expected_cost = png_filter_row(type, bpp, row, prev, expected, len);
+        if (png_simd_select("sse2")) {
+          uint64_t actual_cost = png_filter_row(type, bpp, row, prev, actual, len);
+          ASSERT(actual_cost == expected_cost);
+          ASSERT(memcmp(actual, expected, len) == 0);
+        }
+      }
+    }
+  }
+  ASSERT(png_simd_select(impl));
+}
+
+void test_png_filter_modes(TestObjs *objs) {
+  // whatever filters are chosen, the file decodes to the same pixels
+  ASSERT(read_image("img/NpcGuest_lg.png", &objs->spritemap) == IMG_SUCCESS);
+  uint32_t w = objs->spritemap.width, h = objs->spritemap.height;
+  unsigned char *bytes = (unsigned char *) malloc(w * h * 4);
+  ASSERT(bytes != NULL);
+  for (uint32_t i = 0; i < w * h; i++) {
+    uint32_t color = objs->spritemap.data[i];
+    bytes[i * 4] = color >> 24;
+    bytes[i * 4 + 1] = color >> 16;
+    bytes[i * 4 + 2] = color >> 8;
+    bytes[i * 4 + 3] = color;
+  }
+
+  int modes[] = { PNG_FILTER_MODE_NONE, PNG_FILTER_MODE_FAST, PNG_FILTER_MODE_BALANCED, PNG_FILTER_MODE_MAX };
+  for (unsigned m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    png_t png;
+    ASSERT(png_open_file_write(&png, "test_png_filter_modes.png") == PNG_NO_ERROR);
+    ASSERT(png_set_filter_mode(&png, modes[m]) == PNG_NO_ERROR);
+    ASSERT(png_set_data(&png, w, h, 8, PNG_TRUECOLOR_ALPHA, bytes) == PNG_NO_ERROR);
+    png_close_file(&png);
+
+    struct Image copy;
+    ASSERT(read_image("test_png_filter_modes.png", &copy) == IMG_SUCCESS);
+    ASSERT(copy.width == w && copy.height == h);
+    ASSERT(memcmp(copy.data, objs->spritemap.data, w * h * sizeof(uint32_t)) == 0);
+    free(copy.data);
+  }
+
+  png_t png;
+  ASSERT(png_open_file_write(&png, "test_png_filter_modes.png") == PNG_NO_ERROR);
+  ASSERT(png_set_filter_mode(&png, 4) == PNG_WRONG_ARGUMENTS);
+  png_close_file(&png);
+
+  remove("test_png_filter_modes.png");
+  free(bytes);
+}
+
+void test_png_unfilter_row(TestObjs *objs) {
+  // every implementation unfilters exactly like the scalar one,
+  // both in place and into another buffer, with and without a
+  // row above
+  unsigned char in[200], prev[200], expected[200], actual[200];
+  uint32_t seed = 4242;
+  for (unsigned i = 0; i < sizeof(in); i++) {
+    seed = seed * 1103515245U + 12345U;
+    in[i] = (unsigned char) (seed >> 16);
+    prev[i] = (unsigned char) (seed >> 24);
+  }
+
+  const char *impl = png_simd_impl();
+  const char *names[] = { "avx2", "ssse3", "sse2" };
+  for (unsigned n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+    if (!png_simd_select(names[n])) {
+      continue;
+    }
+    for (int type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++) {
+      for (unsigned bpp = 1; bpp <= 8; bpp++) {
+        for (size_t len = bpp; len <= sizeof(in); len += bpp * 5) {
+          for (int first_row = 0; first_row <= 1; first_row++) {
+            const unsigned char *above = first_row ? NULL : prev;
+
+            ASSERT(png_simd_select("scalar"));
+            png_unfilter_row(type, bpp, in, above, expected, len);
+            ASSERT(png_simd_select(names[n]));
+            png_unfilter_row(type, bpp, in, above, actual, len);
+            ASSERT(memcmp(actual, expected, len) == 0);
+
+            memcpy(actual, in, len);
+            png_unfilter_row(type, bpp, actual, above, actual, len);
+            ASSERT(memcmp(actual, expected, len) == 0);
+          }
+        }
+      }
+    }
+  }
+  ASSERT(png_simd_select(impl));
+}
+
+void test_write_image_ex(TestObjs *objs) {
+  // every preset round-trips
+  ASSERT(read_image("img/NpcGuest_lg.png", &objs->spritemap) == IMG_SUCCESS);
+  const struct PngWriteOptions *presets[] = { &PNG_WRITE_DEFAULT, &PNG_WRITE_PREVIEW, &PNG_WRITE_ARCHIVE };
+  for (unsigned i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+    ASSERT(write_image_ex("test_write_image_ex.png", &objs->spritemap, presets[i]) == IMG_SUCCESS);
+    struct Image copy;
+    ASSERT(read_image("test_write_image_ex.png", &copy) == IMG_SUCCESS);
+    ASSERT(copy.width == objs->spritemap.width && copy.height == objs->spritemap.height);
+    ASSERT(memcmp(copy.data, objs->spritemap.data, copy.width * copy.height * sizeof(uint32_t)) == 0);
+    free(copy.data);
+  }
+
+  // a small IDAT size splits the data into many chunks, and
+  // level 0 stores it uncompressed (so the file is bigger than the pixels)
+  struct PngWriteOptions opts = PNG_WRITE_DEFAULT;
+  opts.level = 0;
+  opts.strategy = IMG_STRATEGY_RLE;
+  opts.idat_size = 1000;
+  ASSERT(write_image_ex("test_write_image_ex.png", &objs->spritemap, &opts) == IMG_SUCCESS);
+  uint32_t pixel_bytes = objs->spritemap.width * objs->spritemap.height * 4;
+  ASSERT(count_idats("test_write_image_ex.png") > pixel_bytes / 1000);
+  struct Image copy;
+  ASSERT(read_image("test_write_image_ex.png", &copy) == IMG_SUCCESS);
+  ASSERT(memcmp(copy.data, objs->spritemap.data, pixel_bytes) == 0);
+  free(copy.data);
+  remove("test_write_image_ex.png");
+
+  // out of range options fail before the file is created
+  struct PngWriteOptions bad[4] = { PNG_WRITE_DEFAULT, PNG_WRITE_DEFAULT, PNG_WRITE_DEFAULT, PNG_WRITE_DEFAULT };
+  bad[0].level = 10;
+  bad[1].strategy = 5;
+  bad[2].filter_mode = -1;
+  bad[3].idat_size = 0;
+  for (unsigned i = 0; i < 4; i++) {
+    ASSERT(write_image_ex("test_write_image_ex.png", &objs->spritemap, &bad[i]) == IMG_ERR_BAD_OPTIONS);
+    ASSERT(access("test_write_image_ex.png", F_OK) != 0);
+  }
+}
+
+//
+// Reads a whole file into memory. Returns its size, or 0 if it
+// can't be read.
+//
+long read_file(const char *filename, unsigned char **contents) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  *contents = (unsigned char *) malloc(size);
+  if (*contents == NULL || fread(*contents, 1, size, f) != (size_t) size) {
+    size = 0;
+  }
+  fclose(f);
+  return size;
+}
+
+void test_write_image_threads(TestObjs *objs) {
+  // tall enough for several batches of 256 KiB segments, with
+  // runs that repeat across segment edges and noise that doesn't
+  const uint32_t w = 300, h = 1500;
+  struct Image img;
+  init_image(&img, w, h);
+  uint32_t seed = 99;
+  for (uint32_t i = 0; i < w * h; i++) {
+    seed = seed * 1103515245U + 12345U;
+    img.data[i] = (i / w) % 7 < 3 ? (seed ^ (seed >> 16)) : 0x336699ffU + (i % w) / 50;
+  }
+
+  int modes[] = { IMG_FILTER_NONE, IMG_FILTER_BALANCED, IMG_FILTER_MAX };
+  uint32_t threads[] = { 2, 3, 8 };
+  for (unsigned m = 0; m < 3; m++) {
+    struct PngWriteOptions opts = PNG_WRITE_DEFAULT;
+    opts.filter_mode = modes[m];
+    opts.threads = threads[m];
+    ASSERT(write_image_ex("test_write_image_threads.png", &img, &opts) == IMG_SUCCESS);
+
+    struct Image copy;
+    ASSERT(read_image("test_write_image_threads.png", &copy) == IMG_SUCCESS);
+    ASSERT(copy.width == w && copy.height == h);
+    ASSERT(memcmp(copy.data, img.data, w * h * sizeof(uint32_t)) == 0);
+    free(copy.data);
+  }
+
+  // an image that fits in one segment is written exactly as
+  // it is with one thread
+  ASSERT(read_image("img/PrtMimi_lg.png", &objs->tilemap) == IMG_SUCCESS);
+  struct Image small = { .width = 64, .height = 64, .data = NULL, .opacity = NULL };
+  small.data = (uint32_t *) malloc(64 * 64 * sizeof(uint32_t));
+  ASSERT(small.data != NULL);
+  for (uint32_t y = 0; y < 64; y++) {
+    memcpy(small.data + y * 64, objs->tilemap.data + y * objs->tilemap.width, 64 * sizeof(uint32_t));
+  }
+  struct PngWriteOptions opts = PNG_WRITE_DEFAULT;
+  opts.threads = 1;
+  ASSERT(write_image_ex("test_write_image_threads.png", &small, &opts) == IMG_SUCCESS);
+  unsigned char *one, *four;
+  long one_size = read_file("test_write_image_threads.png", &one);
+  opts.threads = 4;
+  ASSERT(write_image_ex("test_write_image_threads.png", &small, &opts) == IMG_SUCCESS);
+  long four_size = read_file("test_write_image_threads.png", &four);
+  ASSERT(one_size > 0 && one_size == four_size);
+  ASSERT(memcmp(one, four, one_size) == 0);
+
+  free(one);
+  free(four);
+  free(small.data);
+  free(img.data);
+  remove("test_write_image_threads.png");
+}
+
+void test_read_image_threads(TestObjs *objs) {
+  // several batches of rows per thread, with every filter type
+  // so that some rows depend on the rows above them
+  const uint32_t w = 300, h = 2000;
+  struct Image img;
+  init_image(&img, w, h);
+  uint32_t seed = 7;
+  for (uint32_t i = 0; i < w * h; i++) {
+    seed = seed * 1103515245U + 12345U;
+    img.data[i] = (i / w) % 5 < 2 ? (seed ^ (seed >> 16)) : 0x20406080U + (i % w) * 0x01010100U + i / w;
+  }
+  struct PngWriteOptions write_opts = PNG_WRITE_DEFAULT;
+  write_opts.filter_mode = IMG_FILTER_BALANCED;
+  ASSERT(write_image_ex("test_read_image_threads.png", &img, &write_opts) == IMG_SUCCESS);
+
+  uint32_t threads[] = { 1, 2, 3, 8 };
+  for (unsigned t = 0; t < 4; t++) {
+    struct ImageReadOptions opts = { .threads = threads[t] };
+    struct Image copy;
+    ASSERT(read_image_ex("test_read_image_threads.png", &copy, &opts) == IMG_SUCCESS);
+    ASSERT(copy.width == w && copy.height == h);
+    ASSERT(memcmp(copy.data, img.data, w * h * sizeof(uint32_t)) == 0);
+    free(copy.data);
+  }
+
+  // so does an image written by something else
+  struct ImageReadOptions opts = { .threads = 4 };
+  struct Image copy;
+  ASSERT(read_image("img/PrtMimi_lg.png", &objs->tilemap) == IMG_SUCCESS);
+  ASSERT(read_image_ex("img/PrtMimi_lg.png", &copy, &opts) == IMG_SUCCESS);
+  ASSERT(memcmp(copy.data, objs->tilemap.data, copy.width * copy.height * sizeof(uint32_t)) == 0);
+  free(copy.data);
+
+  // a file cut off in the middle of a batch still fails
+  unsigned char *data;
+  long size = read_file("test_read_image_threads.png", &data);
+  ASSERT(size > 0);
+  FILE *out = fopen("test_read_image_threads.png", "wb");
+  ASSERT(out != NULL);
+  ASSERT(fwrite(data, 1, size / 2, out) == (size_t) (size / 2));
+  fclose(out);
+  ASSERT(read_image_ex("test_read_image_threads.png", &copy, &opts) != IMG_SUCCESS);
+
+  free(data);
+  free(img.data);
+  remove("test_read_image_threads.png");
+}
+
+void test_png_pixel_conversions(TestObjs *objs) {
+  // every implementation converts exactly like the byte order
+  // rules, for every row length up to a few vectors, and writes
+  // nothing past the end of the row
+  unsigned char bytes[4 * 40 + 4];
+  uint32_t pixels[40 + 1];
+  uint32_t seed = 777;
+  for (unsigned i = 0; i < sizeof(bytes); i++) {
+    seed = seed * 1103515245U + 12345U;
+    bytes[i] = (unsigned char) (seed >> 16);
+  }
+
+  const char *impl = png_simd_impl();
+  const char *names[] = { "avx2", "ssse3", "sse2", "scalar" };
+  for (unsigned m = 0; m < sizeof(names) / sizeof(names[0]); m++) {
+    if (!png_simd_select(names[m])) {
+      continue;
+    }
+    for (size_t n = 0; n <= 40; n++) {
+      pixels[n] = 0xdeadbeefU;
+      png_rgb_to_pixels(bytes, pixels, n);
+      for (size_t i = 0; i < n; i++) {
+        const unsigned char *p = bytes + i * 3;
+        ASSERT(pixels[i] == (((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | 0xFF));
+      }
+      ASSERT(pixels[n] == 0xdeadbeefU);
+
+      png_rgba_to_pixels(bytes, pixels, n);
+      for (size_t i = 0; i < n; i++) {
+        const unsigned char *p = bytes + i * 4;
+        ASSERT(pixels[i] == (((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3]));
+      }
+      ASSERT(pixels[n] == 0xdeadbeefU);
+
+      // and back again
+      unsigned char rgba[4 * 40 + 4];
+      memset(rgba, 0xAA, sizeof(rgba));
+      png_pixels_to_rgba(pixels, rgba, n);
+      ASSERT(memcmp(rgba, bytes, n * 4) == 0);
+      ASSERT(rgba[n * 4] == 0xAA);
+    }
+  }
+  ASSERT(png_simd_select(impl));
+}
+
+void test_png_open_mem_read(TestObjs *objs) {
+  // a file in memory decodes to the same pixels as the file
+  // (which read_image maps), with either pnglite API
+  ASSERT(read_image("img/NpcGuest_lg.png", &objs->spritemap) == IMG_SUCCESS);
+  unsigned char *file;
+  long size = read_file("img/NpcGuest_lg.png", &file);
+  ASSERT(size > 0);
+
+  png_t png;
+  ASSERT(png_open_mem_read(&png, file, size) == PNG_NO_ERROR);
+  ASSERT(png.width == objs->spritemap.width && png.height == objs->spritemap.height && png.bpp == 4);
+  size_t num_pixels = (size_t) png.width * png.height;
+  unsigned char *data = (unsigned char *) malloc(num_pixels * 4);
+  ASSERT(data != NULL);
+  ASSERT(png_get_data(&png, data) == PNG_NO_ERROR);
+  for (size_t i = 0; i < num_pixels; i++) {
+    const unsigned char *p = data + i * 4;
+    ASSERT(objs->spritemap.data[i] ==
+           (((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3]));
+  }
+  free(data);
+
+  // a damaged IDAT is caught by its CRC, whether the file is
+  // mapped or in memory
+  long idat = 8;
+  while (idat + 8 <= size && memcmp(file + idat + 4, "IDAT", 4) != 0) {
+    idat += 12 + (((long) file[idat] << 24) | (file[idat + 1] << 16) | (file[idat + 2] << 8) | file[idat + 3]);
+  }
+  ASSERT(idat + 8 <= size);
+  file[idat + 20] ^= 0x40;
+  ASSERT(png_open_mem_read(&png, file, size) == PNG_NO_ERROR);
+  data = (unsigned char *) malloc(num_pixels * 4);
+  ASSERT(data != NULL);
+  ASSERT(png_get_data(&png, data) == PNG_CRC_ERROR);
+  free(data);
+
+  FILE *out = fopen("test_png_open_mem_read.png", "wb");
+  ASSERT(out != NULL);
+  ASSERT(fwrite(file, 1, size, out) == (size_t) size);
+  fclose(out);
+  struct Image copy;
+  ASSERT(read_image("test_png_open_mem_read.png", &copy) != IMG_SUCCESS);
+
+  // as is a file cut off in the middle of a chunk
+  ASSERT(png_open_mem_read(&png, file, idat + 30) == PNG_NO_ERROR);
+  data = (unsigned char *) malloc(num_pixels * 4);
+  ASSERT(data != NULL);
+  ASSERT(png_get_data(&png, data) == PNG_FILE_ERROR);
+  free(data);
+
+  free(file);
+  remove("test_png_open_mem_read.png");
+}
+
+void test_png_crc32(TestObjs *objs) {
+  // every implementation matches zlib's crc32, for lengths
+  // around the 16 and 64 byte blocks, any alignment, and
+  // continued from an earlier CRC
+  unsigned char buf[600];
+  uint32_t seed = 31337;
+  for (unsigned i = 0; i < sizeof(buf); i++) {
+    seed = seed * 1103515245U + 12345U;
+    buf[i] = (unsigned char) (seed >> 16);
+  }
+
+  const char *impl = png_crc_impl();
+  const char *names[] = { "pclmul", "slice8" };
+  for (unsigned m = 0; m < sizeof(names) / sizeof(names[0]); m++) {
+    if (!png_crc_select(names[m])) {
+      continue;
+    }
+    for (size_t offset = 0; offset < 16; offset += 3) {
+      for (size_t len = 0; len + offset <= sizeof(buf); len += len < 160 ? 1 : 37) {
+        ASSERT(png_crc32(0, buf + offset, len) == crc32(0, buf + offset, len));
+        ASSERT(png_crc32(0x12345678U, buf + offset, len) == crc32(0x12345678U, buf + offset, len));
+      }
+    }
+  }
+  ASSERT(png_crc_select(impl));
+
+  // a file with a wrong IDAT CRC only reads when told to skip
+  // the checks
+  ASSERT(read_image("img/PrtMimi.png", &objs->tilemap) == IMG_SUCCESS);
+  ASSERT(write_image("test_png_crc32.png", &objs->tilemap) == IMG_SUCCESS);
+  unsigned char *file;
+  long size = read_file("test_png_crc32.png", &file);
+  ASSERT(size > 0);
+  long idat = 8;
+  while (idat + 8 <= size && memcmp(file + idat + 4, "IDAT", 4) != 0) {
+    idat += 12 + (((long) file[idat] << 24) | (file[idat + 1] << 16) | (file[idat + 2] << 8) | file[idat + 3]);
+  }
+  ASSERT(idat + 8 <= size);
+  long length = ((long) file[idat] << 24) | (file[idat + 1] << 16) | (file[idat + 2] << 8) | file[idat + 3];
+  file[idat + 8 + length] ^= 1;
+  FILE *out = fopen("test_png_crc32.png", "wb");
+  ASSERT(out != NULL);
+  ASSERT(fwrite(file, 1, size, out) == (size_t) size);
+  fclose(out);
+
+  struct Image copy;
+  ASSERT(read_image("test_png_crc32.png", &copy) != IMG_SUCCESS);
+  struct ImageReadOptions opts = PNG_READ_DEFAULT;
+  opts.skip_crc = 1;
+  ASSERT(read_image_ex("test_png_crc32.png", &copy, &opts) == IMG_SUCCESS);
+  ASSERT(memcmp(copy.data, objs->tilemap.data, copy.width * copy.height * sizeof(uint32_t)) == 0);
+  free(copy.data);
+
+  free(file);
+  remove("test_png_crc32.png");
+}
+
+void test_image_cache(TestObjs *objs) {
+  ASSERT(read_image("img/PrtMimi.png", &objs->tilemap) == IMG_SUCCESS);
+  ASSERT(read_image("img/NpcGuest.png", &objs->spritemap) == IMG_SUCCESS);
+  ASSERT(write_image("test_image_cache_a.png", &objs->tilemap) == IMG_SUCCESS);
+  ASSERT(write_image("test_image_cache_b.png", &objs->spritemap) == IMG_SUCCESS);
+
+  // room for either of the two images (with their indexes), but
+  // not both, once they are released
+  size_t tile_bytes = (size_t) objs->tilemap.width * objs->tilemap.height * sizeof(uint32_t);
+  size_t sprite_bytes = (size_t) objs->spritemap.width * objs->spritemap.height * sizeof(uint32_t);
+  struct ImageCache *cache;
+  ASSERT(image_cache_create(&cache, sprite_bytes * 3 / 2) == IMG_SUCCESS);
+  struct ImageCacheStats stats;
+
+  // loads of the same file share pixels and an opacity index
+  struct Image a1, a2, b;
+  ASSERT(image_cache_load(cache, "test_image_cache_a.png", &a1) == IMG_SUCCESS);
+  ASSERT(image_cache_load(cache, "test_image_cache_a.png", &a2) == IMG_SUCCESS);
+  ASSERT(a1.data == a2.data && a1.opacity != NULL && a1.opacity == a2.opacity);
+  ASSERT(a1.width == objs->tilemap.width && a1.height == objs->tilemap.height);
+  ASSERT(memcmp(a1.data, objs->tilemap.data, tile_bytes) == 0);
+  image_cache_stats(cache, &stats);
+  ASSERT(stats.hits == 1 && stats.misses == 1 && stats.images == 1);
+
+  // images in use are kept even over the limit
+  ASSERT(image_cache_load(cache, "test_image_cache_b.png", &b) == IMG_SUCCESS);
+  ASSERT(memcmp(b.data, objs->spritemap.data, sprite_bytes) == 0);
+  image_cache_stats(cache, &stats);
+  ASSERT(stats.images == 2 && stats.evictions == 0);
+
+  // released images stay cached until they don't fit, the least
+  // recently used going first
+  image_cache_release(cache, &a1);
+  image_cache_release(cache, &a2);
+  ASSERT(a1.data == NULL && a2.data == NULL);
+  image_cache_stats(cache, &stats);
+  ASSERT(stats.images == 1 && stats.evictions == 1);
+  image_cache_release(cache, &b);
+  ASSERT(image_cache_load(cache, "test_image_cache_b.png", &b) == IMG_SUCCESS);
+  image_cache_stats(cache, &stats);
+  ASSERT(stats.hits == 2 && stats.misses == 2);
+
+  // a file that changed is read again
+  struct Image small = { .width = 8, .height = 8, .data = NULL, .opacity = NULL };
+  ASSERT(init_image(&small, 8, 8) == IMG_SUCCESS);
+  ASSERT(write_image("test_image_cache_b.png", &small) == IMG_SUCCESS);
+  struct Image b2;
+  ASSERT(image_cache_load(cache, "test_image_cache_b.png", &b2) == IMG_SUCCESS);
+  ASSERT(b2.data != b.data && b2.width == 8 && b2.height == 8);
+  image_cache_stats(cache, &stats);
+  ASSERT(stats.misses == 3);
+
+  // and a missing file is an error
+  struct Image missing;
+  ASSERT(image_cache_load(cache, "test_image_cache_missing.png", &missing) != IMG_SUCCESS);
+
+  image_cache_release(cache, &b);
+  image_cache_release(cache, &b2);
+  image_cache_destroy(cache);
+  free(small.data);
+  remove("test_image_cache_a.png");
+  remove("test_image_cache_b.png");
+}
+
+void test_rgba_image(TestObjs *objs) {
+  // rows that need no padding are mapped, not copied
+  ASSERT(read_image("img/PrtMimi.png", &objs->tilemap) == IMG_SUCCESS);
+  ASSERT(objs->tilemap.width % 16 == 0);
+  size_t tile_bytes = (size_t) objs->tilemap.width * objs->tilemap.height * sizeof(uint32_t);
+  ASSERT(write_rgba_image("test_rgba_image.rgba", &objs->tilemap) == IMG_SUCCESS);
+  struct Image mapped;
+  ASSERT(read_image("test_rgba_image.rgba", &mapped) == IMG_SUCCESS);
+  ASSERT(mapped.mapping != NULL && mapped.opacity == NULL);
+  ASSERT(mapped.width == objs->tilemap.width && mapped.height == objs->tilemap.height);
+  ASSERT(((uintptr_t) mapped.data & 63) == 0);
+  ASSERT(memcmp(mapped.data, objs->tilemap.data, tile_bytes) == 0);
+
+  // drawing onto it doesn't change the file
+  struct Rect r = { .x = 0, .y = 0, .width = 40, .height = 40 };
+  draw_rect(&mapped, &r, 0x123456ffU);
+  ASSERT(mapped.data[0] == 0x123456ffU);
+  struct Image again;
+  ASSERT(read_image("test_rgba_image.rgba", &again) == IMG_SUCCESS);
+  ASSERT(memcmp(again.data, objs->tilemap.data, tile_bytes) == 0);
+  free_image(&again);
+  free_image(&mapped);
+  ASSERT(mapped.data == NULL && mapped.mapping == NULL);
+
+  // other widths have padded rows, which are copied out
+  struct Image odd;
+  ASSERT(init_image(&odd, 30, 7) == IMG_SUCCESS);
+  for (uint32_t i = 0; i < 30 * 7; i++) {
+    odd.data[i] = i * 0x01020304U;
+  }
+  ASSERT(write_rgba_image("test_rgba_image.rgba", &odd) == IMG_SUCCESS);
+  struct Image copy;
+  ASSERT(read_image("test_rgba_image.rgba", &copy) == IMG_SUCCESS);
+  ASSERT(copy.mapping == NULL && copy.width == 30 && copy.height == 7);
+  ASSERT(memcmp(copy.data, odd.data, 30 * 7 * sizeof(uint32_t)) == 0);
+  free_image(&copy);
+
+  // a file cut short is an error
+  unsigned char *file;
+  long size = read_file("test_rgba_image.rgba", &file);
+  ASSERT(size == 64 + 7 * 128);
+  FILE *out = fopen("test_rgba_image.rgba", "wb");
+  ASSERT(out != NULL);
+  ASSERT(fwrite(file, 1, size - 1, out) == (size_t) (size - 1));
+  fclose(out);
+  ASSERT(read_image("test_rgba_image.rgba", &copy) != IMG_SUCCESS);
+
+  free(file);
+  free_image(&odd);
+  remove("test_rgba_image.rgba");
+}